@@ -0,0 +1,211 @@
+//! Generators of documents shaped like the usual json benchmark files.
+//!
+//! The output only depends on the size asked for, so runs can be compared.
+
+/// Xorshift generator, good enough to vary the documents.
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Self {
+        Rng(seed | 1)
+    }
+
+    pub fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+
+    pub fn below(&mut self, n: u64) -> u64 {
+        self.next() % n
+    }
+
+    pub fn f64(&mut self) -> f64 {
+        (self.next() >> 11) as f64 / (1u64 << 53) as f64
+    }
+
+    fn pick<'a>(&mut self, items: &[&'a str]) -> &'a str {
+        items[self.below(items.len() as u64) as usize]
+    }
+}
+
+const WORDS: &[&str] = &[
+    "json",
+    "parser",
+    "fast",
+    "release",
+    "today",
+    "rust",
+    "benchmark",
+    "coffee",
+    "東京",
+    "日本語",
+    "中文",
+    "测试",
+    "한국어",
+    "café",
+    "naïve",
+    "😀",
+    "🚀",
+];
+
+fn text(rng: &mut Rng, words: u64) -> String {
+    let mut s = String::new();
+    for i in 0..words {
+        if i > 0 {
+            s.push(' ');
+        }
+        match rng.below(20) {
+            0 => s += "\\\"quoted\\\"",
+            1 => s += "line\\nbreak",
+            2 => s += "\\u00e9t\\u00e9",
+            3 => s += "\\ud83d\\ude00",
+            _ => s += rng.pick(WORDS),
+        }
+    }
+    s
+}
+
+/// Repeats `item` in a top-level array until it reaches `size` bytes.
+fn array_of(size: usize, mut item: impl FnMut(usize) -> String) -> String {
+    let mut out = String::with_capacity(size + 1024);
+    out.push('[');
+    let mut i = 0;
+    while out.len() < size {
+        if i > 0 {
+            out.push_str(",\n");
+        }
+        out += &item(i);
+        i += 1;
+    }
+    out.push(']');
+    out
+}
+
+/// Statuses with users, entities and a lot of non-ascii text.
+pub fn twitter(size: usize) -> String {
+    let mut rng = Rng::new(1);
+    array_of(size, |i| {
+        let words = 4 + rng.below(16);
+        let hashtags: Vec<_> = (0..rng.below(3))
+            .map(|_| {
+                format!(
+                    r#"{{"text": "{}", "indices": [{}, {}]}}"#,
+                    rng.pick(WORDS),
+                    i,
+                    i + 5
+                )
+            })
+            .collect();
+        format!(
+            r#"{{"id": {}, "id_str": "{}", "text": "{}", "truncated": false, "in_reply_to_status_id": null, "user": {{"id": {}, "name": "{}", "screen_name": "user_{}", "followers_count": {}, "verified": {}, "lang": "ja"}}, "entities": {{"hashtags": [{}], "urls": []}}, "retweet_count": {}, "favorited": {}}}"#,
+            505874924095815680u64 + i as u64,
+            505874924095815680u64 + i as u64,
+            text(&mut rng, words),
+            rng.below(1 << 30),
+            text(&mut rng, 2),
+            i % 1000,
+            rng.below(100_000),
+            rng.below(2) == 0,
+            hashtags.join(", "),
+            rng.below(50),
+            rng.below(2) == 0
+        )
+    })
+}
+
+/// Products with ids, prices and deep-ish optional attributes.
+pub fn catalog(size: usize) -> String {
+    let mut rng = Rng::new(2);
+    array_of(size, |i| {
+        let attributes: Vec<_> = (0..1 + rng.below(6))
+            .map(|a| format!(r#""attr_{}": "{}""#, a, rng.pick(WORDS)))
+            .collect();
+        format!(
+            r#"{{"sku": "SKU-{:08}", "name": "{}", "price": {:.2}, "currency": "EUR", "stock": {}, "categories": ["{}", "{}"], "attributes": {{{}}}, "dimensions": {{"w": {:.1}, "h": {:.1}, "d": {:.1}}}, "discontinued": {}, "supplier": null}}"#,
+            i,
+            text(&mut rng, 3),
+            rng.f64() * 500.0,
+            rng.below(1000),
+            rng.pick(WORDS),
+            rng.pick(WORDS),
+            attributes.join(", "),
+            rng.f64() * 100.0,
+            rng.f64() * 100.0,
+            rng.f64() * 100.0,
+            rng.below(10) == 0
+        )
+    })
+}
+
+/// Geometry made almost only of coordinates, like canada.json.
+pub fn canada(size: usize) -> String {
+    let mut rng = Rng::new(3);
+    array_of(size, |_| {
+        let points: Vec<_> = (0..64)
+            .map(|_| {
+                format!(
+                    "[{:.15}, {:.14}]",
+                    -65.0 - rng.f64() * 75.0,
+                    43.0 + rng.f64() * 40.0
+                )
+            })
+            .collect();
+        format!(
+            r#"{{"type": "Polygon", "coordinates": [[{}]], "bbox": [-1.5e2, 4.1e1, -5.2e1, 8.3e1]}}"#,
+            points.join(", ")
+        )
+    })
+}
+
+/// Values nested `depth` levels deep, alternating arrays and objects.
+pub fn nested(size: usize, depth: usize) -> String {
+    let mut rng = Rng::new(4);
+    array_of(size, |_| {
+        let mut s = String::new();
+        for d in 0..depth {
+            s += if d % 2 == 0 { r#"{"n": "# } else { "[1, " };
+        }
+        s += &rng.below(1000).to_string();
+        for d in (0..depth).rev() {
+            s += if d % 2 == 0 { "}" } else { "]" };
+        }
+        s
+    })
+}
+
+/// A single object mapping user ids to small records.
+pub fn users(size: usize) -> String {
+    let mut rng = Rng::new(5);
+    let mut out = String::with_capacity(size + 1024);
+    out.push('{');
+    let mut i = 0;
+    while out.len() < size {
+        if i > 0 {
+            out.push_str(",\n");
+        }
+        out += &format!(
+            r#""{}": {{"score": {}, "name": "{}"}}"#,
+            user_id(i),
+            rng.below(1000),
+            rng.pick(WORDS)
+        );
+        i += 1;
+    }
+    out.push('}');
+    out
+}
+
+pub fn user_id(i: usize) -> String {
+    format!("u{:016x}", (i as u64).wrapping_mul(0x9E37_79B9_7F4A_7C15))
+}
+
+/// One twitter-like status per line.
+pub fn ndjson(size: usize) -> String {
+    let doc = twitter(size);
+    let inner = &doc[1..doc.len() - 1];
+    let mut out = inner.replace(",\n", "\n");
+    out.push('\n');
+    out
+}
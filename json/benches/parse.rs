@@ -0,0 +1,232 @@
+//! Throughput, allocations and peak memory of the parsing entry points.
+//!
+//! Run with `cargo bench --bench parse`, optionally followed by
+//! `-- <filter>` to only run the cases whose name contains the filter, and
+//! `--sizes 1,16` to pick the sizes of the documents in MB.
+
+mod corpus;
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::hint::black_box;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::{Duration, Instant};
+
+use json::{analyse_bytes, analyse_parallel, compile, from_str, validate, FromJson};
+use json::{select, Format, Kind, Node, Parser, PushParser, Query, Snapshot, DEFAULT_MAX_DEPTH};
+
+/// Forwards to the system allocator, counting allocations and live bytes.
+struct Counting;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static LIVE: AtomicUsize = AtomicUsize::new(0);
+static PEAK: AtomicUsize = AtomicUsize::new(0);
+
+fn grow(bytes: usize) {
+    let live = LIVE.fetch_add(bytes, Ordering::Relaxed) + bytes;
+    PEAK.fetch_max(live, Ordering::Relaxed);
+}
+
+unsafe impl GlobalAlloc for Counting {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        grow(layout.size());
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        LIVE.fetch_sub(layout.size(), Ordering::Relaxed);
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        LIVE.fetch_sub(layout.size(), Ordering::Relaxed);
+        grow(new_size);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: Counting = Counting;
+
+const MB: f64 = 1024.0 * 1024.0;
+const MIN_TIME: Duration = Duration::from_millis(500);
+
+struct Measure {
+    mb_per_s: f64,
+    allocations_per_mb: f64,
+    peak_mb: f64,
+}
+
+/// Runs `f` until `MIN_TIME` is spent, keeping the best time. Allocations
+/// and peak memory are the ones of the first run, above what was live
+/// before it.
+fn measure(len: usize, mut f: impl FnMut()) -> Measure {
+    let live = LIVE.load(Ordering::Relaxed);
+    PEAK.store(live, Ordering::Relaxed);
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    f();
+    let mut best = start.elapsed();
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+    let peak = PEAK.load(Ordering::Relaxed) - live;
+
+    let spent = Instant::now();
+    while spent.elapsed() < MIN_TIME {
+        let start = Instant::now();
+        f();
+        best = best.min(start.elapsed());
+    }
+
+    let mb = len as f64 / MB;
+    Measure {
+        mb_per_s: mb / best.as_secs_f64(),
+        allocations_per_mb: allocations as f64 / mb,
+        peak_mb: peak as f64 / MB,
+    }
+}
+
+// Fields are only parsed, never read
+#[allow(dead_code)]
+#[derive(FromJson)]
+struct User {
+    id: u64,
+    screen_name: String,
+    followers_count: u64,
+}
+
+#[allow(dead_code)]
+#[derive(FromJson)]
+struct Status {
+    id: u64,
+    text: String,
+    user: User,
+    retweet_count: u32,
+}
+
+/// Visits every value of a snapshot, returning how many there are.
+fn walk(node: Node) -> usize {
+    match node.kind() {
+        Kind::Array => 1 + node.items().map(walk).sum::<usize>(),
+        Kind::Object => 1 + node.entries().map(|(_, v)| walk(v)).sum::<usize>(),
+        _ => 1,
+    }
+}
+
+fn parse_args() -> (Option<String>, Vec<usize>) {
+    let mut filter = None;
+    let mut sizes = vec![1, 16];
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--sizes" => {
+                let list = args.next().unwrap_or_default();
+                sizes = list.split(',').filter_map(|s| s.parse().ok()).collect();
+            }
+            // Passed by `cargo bench`
+            "--bench" => (),
+            _ => filter = Some(arg),
+        }
+    }
+    (filter, sizes)
+}
+
+fn main() {
+    let (filter, sizes) = parse_args();
+    let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    println!(
+        "{:<32} {:>10} {:>12} {:>10}",
+        "case", "MB/s", "allocs/MB", "peak MB"
+    );
+
+    for size in sizes {
+        let len = size * 1024 * 1024;
+        let documents = [
+            ("twitter", corpus::twitter(len)),
+            ("catalog", corpus::catalog(len)),
+            ("canada", corpus::canada(len)),
+            ("nested", corpus::nested(len, 512)),
+        ];
+        let ndjson = corpus::ndjson(len);
+
+        let run = |name: &str, len: usize, f: &mut dyn FnMut()| {
+            let name = format!("{name}/{size}MB");
+            if filter.as_ref().is_some_and(|f| !name.contains(f.as_str())) {
+                return;
+            }
+            let m = measure(len, f);
+            println!(
+                "{:<32} {:>10.1} {:>12.1} {:>10.2}",
+                name, m.mb_per_s, m.allocations_per_mb, m.peak_mb
+            );
+        };
+
+        for (corpus, doc) in &documents {
+            let raw = doc.as_bytes();
+            run(&format!("validate/{corpus}"), raw.len(), &mut || {
+                validate(raw).unwrap()
+            });
+            run(&format!("analyse/{corpus}"), raw.len(), &mut || {
+                analyse_bytes(raw, DEFAULT_MAX_DEPTH).unwrap();
+            });
+            run(&format!("parallel/{corpus}"), raw.len(), &mut || {
+                analyse_parallel(raw, DEFAULT_MAX_DEPTH, threads).unwrap();
+            });
+            run(&format!("push/{corpus}"), raw.len(), &mut || {
+                let mut parser = PushParser::new();
+                for chunk in raw.chunks(64 * 1024) {
+                    parser.feed(chunk).unwrap();
+                }
+                parser.finish().unwrap();
+            });
+            let snapshot = compile(&analyse_bytes(raw, DEFAULT_MAX_DEPTH).unwrap()).unwrap();
+            run(&format!("compile/{corpus}"), raw.len(), &mut || {
+                compile(&analyse_bytes(raw, DEFAULT_MAX_DEPTH).unwrap()).unwrap();
+            });
+            run(&format!("snapshot/{corpus}"), raw.len(), &mut || {
+                black_box(walk(Snapshot::new(&snapshot).unwrap().root()));
+            });
+        }
+
+        let twitter = &documents[0].1;
+        run("typed/twitter", twitter.len(), &mut || {
+            from_str::<Vec<Status>>(twitter).unwrap();
+        });
+
+        let users = corpus::users(len);
+        let doc = analyse_bytes(users.as_bytes(), DEFAULT_MAX_DEPTH).unwrap();
+        let ids: Vec<_> = (0..doc.root.len()).map(corpus::user_id).collect();
+        run("get/users", users.len(), &mut || {
+            for id in &ids {
+                black_box(doc.get(&doc.root, id).unwrap());
+            }
+        });
+
+        run("validate/ndjson", ndjson.len(), &mut || {
+            for line in ndjson.lines() {
+                validate(line.as_bytes()).unwrap();
+            }
+        });
+        let query =
+            Query::new("id,user.screen_name", Some("favorited==true"), Format::Tsv).unwrap();
+        run("select/ndjson", ndjson.len(), &mut || {
+            select(ndjson.as_bytes(), &mut Vec::new(), &query, threads).unwrap();
+        });
+        run("analyse/ndjson", ndjson.len(), &mut || {
+            for line in ndjson.lines() {
+                analyse_bytes(line.as_bytes(), DEFAULT_MAX_DEPTH).unwrap();
+            }
+        });
+        let mut parser = Parser::new();
+        run("reuse/validate/ndjson", ndjson.len(), &mut || {
+            for line in ndjson.lines() {
+                parser.validate(line.as_bytes()).unwrap();
+            }
+        });
+        run("reuse/parse/ndjson", ndjson.len(), &mut || {
+            for line in ndjson.lines() {
+                black_box(parser.parse(line.as_bytes()).unwrap());
+            }
+        });
+    }
+}
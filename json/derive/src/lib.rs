@@ -0,0 +1,129 @@
+use proc_macro::{Delimiter, TokenStream, TokenTree};
+
+struct Field {
+    name: String,
+    key: String,
+    ty: String,
+}
+
+/// Generates a `json::FromJson` implementation for a struct with named
+/// fields, reading the object straight into the fields.
+///
+/// Keys are matched on their bytes with slice patterns, which the compiler
+/// turns into a switch on the length then on each byte instead of comparing
+/// the key with every name in turn, and unknown keys are skipped without
+/// being parsed. `Option` fields may be missing, a field given twice is an
+/// error.
+#[proc_macro_derive(FromJson)]
+pub fn derive_from_json(input: TokenStream) -> TokenStream {
+    match parse_struct(input) {
+        Ok((name, fields)) => generate(&name, &fields),
+        Err(e) => format!("compile_error!({e:?});").parse().unwrap(),
+    }
+}
+
+fn parse_struct(input: TokenStream) -> Result<(String, Vec<Field>), String> {
+    let mut iter = input.into_iter();
+    let mut name = None;
+    while let Some(token) = iter.next() {
+        match token {
+            TokenTree::Ident(i) if i.to_string() == "struct" => {
+                name = iter.next().map(|t| t.to_string());
+                break;
+            }
+            TokenTree::Ident(i) if i.to_string() == "enum" || i.to_string() == "union" => {
+                return Err("FromJson can only be derived for structs".to_string())
+            }
+            _ => (),
+        }
+    }
+    let name = name.ok_or("FromJson can only be derived for structs")?;
+
+    match iter.next() {
+        Some(TokenTree::Group(g)) if g.delimiter() == Delimiter::Brace => {
+            Ok((name, parse_fields(g.stream())?))
+        }
+        Some(TokenTree::Punct(p)) if p.as_char() == '<' => {
+            Err("FromJson can't be derived for generic structs".to_string())
+        }
+        _ => Err("FromJson can only be derived for structs with named fields".to_string()),
+    }
+}
+
+/// Splits `name: Type, ...` on the commas that aren't inside a type.
+fn parse_fields(stream: TokenStream) -> Result<Vec<Field>, String> {
+    let mut fields = Vec::new();
+    let mut tokens: Vec<TokenTree> = Vec::new();
+    let mut depth = 0;
+
+    for token in stream {
+        match &token {
+            TokenTree::Punct(p) if p.as_char() == '<' => depth += 1,
+            TokenTree::Punct(p) if p.as_char() == '>' => depth -= 1,
+            TokenTree::Punct(p) if p.as_char() == ',' && depth == 0 => {
+                if !tokens.is_empty() {
+                    fields.push(parse_field(&tokens)?);
+                }
+                tokens.clear();
+                continue;
+            }
+            _ => (),
+        }
+        tokens.push(token);
+    }
+    if !tokens.is_empty() {
+        fields.push(parse_field(&tokens)?);
+    }
+    Ok(fields)
+}
+
+fn parse_field(tokens: &[TokenTree]) -> Result<Field, String> {
+    let colon = tokens
+        .iter()
+        .position(|t| matches!(t, TokenTree::Punct(p) if p.as_char() == ':'))
+        .ok_or("FromJson can only be derived for structs with named fields")?;
+
+    // The name is the last ident before ':', after attributes and visibility
+    let name = match &tokens[..colon].last() {
+        Some(TokenTree::Ident(i)) => i.to_string(),
+        _ => return Err("unexpected field declaration".to_string()),
+    };
+    let ty: TokenStream = tokens[colon + 1..].iter().cloned().collect();
+    Ok(Field {
+        key: name.trim_start_matches("r#").to_string(),
+        name,
+        ty: ty.to_string(),
+    })
+}
+
+fn generate(name: &str, fields: &[Field]) -> TokenStream {
+    let mut code = format!(
+        "impl ::json::FromJson for {name} {{
+            fn from_json(cursor: &mut ::json::Cursor<'_>) -> ::std::result::Result<Self, ::json::Error> {{"
+    );
+    for f in fields {
+        code += &format!(
+            "let mut __{}: ::std::option::Option<{}> = None;",
+            f.key, f.ty
+        );
+    }
+    code += "cursor.begin_object()?; while let Some(key) = cursor.next_key()? { match key.as_bytes() {";
+    for f in fields {
+        let bytes = format!("{:?}", f.key.as_bytes());
+        code += &format!(
+            "{bytes} if __{}.is_some() => return Err(::json::Error::DuplicateKey(key.to_string())),
+            {bytes} => __{} = Some(<{} as ::json::FromJson>::from_json(cursor)?),",
+            f.key, f.key, f.ty
+        );
+    }
+    code += "_ => cursor.skip_value()?, } } Ok(Self {";
+    for f in fields {
+        code += &format!(
+            "{}: __{}.or_else(<{} as ::json::FromJson>::missing)
+                .ok_or(::json::Error::MissingField({:?}))?,",
+            f.name, f.key, f.ty, f.key
+        );
+    }
+    code += "}) } }";
+    code.parse().unwrap()
+}
@@ -0,0 +1,108 @@
+use json::{Error, Format, Query, DEFAULT_MAX_DEPTH};
+use std::path::Path;
+
+pub enum Mode {
+    Validate,
+    Compile,
+    Select(Query),
+    Diff(String), // The document to compare the input with
+}
+
+pub struct Args {
+    pub input: String,
+    pub output: String,
+    pub mode: Mode,
+    pub max_depth: usize,
+    pub threads: usize,
+}
+
+impl Args {
+    pub fn build() -> Result<Self, Error> {
+        let args: Vec<String> = std::env::args().collect();
+        let mut inputs = Vec::new();
+        let mut output = None;
+        let mut mode = Mode::Validate;
+        let mut max_depth = DEFAULT_MAX_DEPTH;
+        let mut threads = 1;
+        let mut select = None;
+        let mut filter = None;
+        let mut format = Format::Tsv;
+
+        let mut iter = args.iter().skip(1);
+        while let Some(arg) = iter.next() {
+            if arg.starts_with("-") {
+                match arg.as_str() {
+                    "--max-depth" => {
+                        max_depth = match iter.next().map(|s| s.parse()) {
+                            Some(Ok(n)) => n,
+                            _ => return Err(Error::BadOption(arg.to_string())),
+                        }
+                    }
+                    "--threads" => {
+                        threads = match iter.next().map(|s| s.parse()) {
+                            Some(Ok(n)) if n > 0 => n,
+                            _ => return Err(Error::BadOption(arg.to_string())),
+                        }
+                    }
+                    "--compile" => mode = Mode::Compile,
+                    "--diff" => mode = Mode::Diff(String::new()),
+                    "--select" => match iter.next() {
+                        Some(s) => select = Some(s.to_string()),
+                        None => return Err(Error::BadOption(arg.to_string())),
+                    },
+                    "--where" => match iter.next() {
+                        Some(s) => filter = Some(s.to_string()),
+                        None => return Err(Error::BadOption(arg.to_string())),
+                    },
+                    "--format" => {
+                        format = match iter.next().map(String::as_str) {
+                            Some("tsv") => Format::Tsv,
+                            Some("ndjson") => Format::Ndjson,
+                            _ => return Err(Error::BadOption(arg.to_string())),
+                        }
+                    }
+                    "-o" => match iter.next() {
+                        Some(s) => output = Some(s.to_string()),
+                        None => return Err(Error::BadOption(arg.to_string())),
+                    },
+                    _ => return Err(Error::BadOption(arg.to_string())),
+                }
+            } else {
+                inputs.push(arg.to_string());
+            }
+        }
+
+        match (&select, &filter) {
+            (Some(select), filter) => {
+                mode = Mode::Select(Query::new(select, filter.as_deref(), format)?)
+            }
+            (None, Some(_)) => return Err(Error::BadOption("--where".to_string())),
+            (None, None) => (),
+        }
+
+        let input = match mode {
+            Mode::Diff(ref mut other) if inputs.len() == 2 => {
+                *other = inputs.pop().unwrap();
+                inputs.pop()
+            }
+            Mode::Diff(_) => return Err(Error::BadOption("--diff".to_string())),
+            _ => inputs.pop(),
+        };
+
+        match input {
+            Some(input) => Ok(Args {
+                output: output.unwrap_or_else(|| {
+                    Path::new(&input)
+                        .with_extension("jbin")
+                        .to_string_lossy()
+                        .to_string()
+                }),
+                input,
+                mode,
+                max_depth,
+                threads,
+            }),
+            None => Err(Error::NoFileProvided),
+        }
+    }
+}
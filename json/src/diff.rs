@@ -0,0 +1,505 @@
+use std::collections::HashMap;
+use std::io::Write;
+
+use crate::error::Error;
+use crate::{Kind, Node, Snapshot, DEFAULT_MAX_DEPTH};
+
+/// Above this many members, the members of an object are looked up in a
+/// map rather than by scanning the other object.
+const MAP_MIN_LEN: usize = 16;
+
+/// Writes the RFC 6902 patch turning the document `a` into `b`.
+///
+/// Both are read from their snapshot, which is walked like a tape. The
+/// hash of every subtree is computed first in a single backward pass, so
+/// the walk only descends where hashes differ. Subtrees whose hashes match
+/// are still compared to be sure, which a difference stops early. Object
+/// hashes don't depend on the order of the members, like json objects.
+/// Scalars are compared in place without any allocation, numbers by their
+/// text, which is also what the patch holds.
+///
+/// Arrays are compared element by element once their common prefix and
+/// suffix are trimmed, so a single insertion or removal gives a single
+/// operation, but moves aren't detected.
+pub fn diff(a: &Snapshot, b: &Snapshot, out: &mut impl Write) -> Result<(), Error> {
+    diff_with_depth(a, b, DEFAULT_MAX_DEPTH, out)
+}
+
+/// Same as `diff`, failing on containers nested deeper than `max_depth`,
+/// which snapshots read as is were never checked for.
+pub fn diff_with_depth(
+    a: &Snapshot,
+    b: &Snapshot,
+    max_depth: usize,
+    out: &mut impl Write,
+) -> Result<(), Error> {
+    let mut differ = Differ {
+        hashes: (subtree_hashes(a), subtree_hashes(b)),
+        path: String::new(),
+        ops: 0,
+        max_depth,
+        out,
+    };
+
+    let write = |r: std::io::Result<()>| r.map_err(|_| Error::FileWriting);
+    write(differ.out.write_all(b"["))?;
+    differ.diff(a.root(), b.root(), 0)?;
+    write(
+        differ
+            .out
+            .write_all(if differ.ops > 0 { b"\n]\n" } else { b"]\n" }),
+    )?;
+    write(differ.out.flush())
+}
+
+/// Multiply-rotate hash reading 8 bytes at a time.
+fn hash_bytes(mut h: u64, bytes: &[u8]) -> u64 {
+    const K: u64 = 0x9E37_79B9_7F4A_7C15;
+    let mut chunks = bytes.chunks_exact(8);
+    for chunk in &mut chunks {
+        h = (h.rotate_left(5) ^ u64::from_le_bytes(chunk.try_into().unwrap())).wrapping_mul(K);
+    }
+    for b in chunks.remainder() {
+        h = (h.rotate_left(5) ^ *b as u64).wrapping_mul(K);
+    }
+    (h.rotate_left(5) ^ bytes.len() as u64).wrapping_mul(K)
+}
+
+/// Hash of every value of the snapshot, by node position.
+///
+/// Nodes are visited backward, so the items of a container, which follow
+/// it, are always hashed before it.
+fn subtree_hashes(snapshot: &Snapshot) -> Vec<u64> {
+    let mut hashes = vec![0u64; snapshot.node_count()];
+    for i in (0..hashes.len()).rev() {
+        let node = snapshot.node(i);
+        if node.is_key() {
+            continue;
+        }
+        let kind = node.kind() as u64;
+        hashes[i] = match node.kind() {
+            Kind::Null => hash_bytes(kind, &[]),
+            Kind::Bool => hash_bytes(kind, &[(node.as_bool() == Some(true)) as u8]),
+            Kind::Number => hash_bytes(kind, node.as_number().unwrap_or_default().as_bytes()),
+            Kind::Str => hash_bytes(kind, node.as_str().unwrap_or_default().as_bytes()),
+            Kind::Array => node.items().fold(hash_bytes(kind, &[]), |h, item| {
+                hash_bytes(h, &hashes[item.id()].to_le_bytes())
+            }),
+            Kind::Object => {
+                let members = node.entries().fold(0u64, |sum, (key, value)| {
+                    sum.wrapping_add(hash_bytes(hashes[value.id()], key.as_bytes()))
+                });
+                hash_bytes(kind, &members.to_le_bytes())
+            }
+        };
+    }
+    hashes
+}
+
+/// Members of an object by key, the first one of a repeated key like `get`.
+fn members<'a>(node: Node<'a>) -> HashMap<&'a str, Node<'a>> {
+    let mut map = HashMap::with_capacity(node.len());
+    for (key, value) in node.entries() {
+        map.entry(key).or_insert(value);
+    }
+    map
+}
+
+/// Escapes a key as a json pointer reference token.
+fn push_token(path: &mut String, key: &str) {
+    path.push('/');
+    for c in key.chars() {
+        match c {
+            '~' => path.push_str("~0"),
+            '/' => path.push_str("~1"),
+            c => path.push(c),
+        }
+    }
+}
+
+fn write_str(out: &mut impl Write, s: &str) -> std::io::Result<()> {
+    out.write_all(b"\"")?;
+    let mut start = 0;
+    for (i, b) in s.bytes().enumerate() {
+        let escaped = match b {
+            b'"' => "\\\"",
+            b'\\' => "\\\\",
+            b'\n' => "\\n",
+            b'\r' => "\\r",
+            b'\t' => "\\t",
+            0..=0x1F => "",
+            _ => continue,
+        };
+        out.write_all(&s.as_bytes()[start..i])?;
+        if escaped.is_empty() {
+            write!(out, "\\u{:04x}", b)?;
+        } else {
+            out.write_all(escaped.as_bytes())?;
+        }
+        start = i + 1;
+    }
+    out.write_all(&s.as_bytes()[start..])?;
+    out.write_all(b"\"")
+}
+
+/// Writes a value of the snapshot back as compact json, `depth` being the
+/// number of containers around it.
+fn write_node(
+    out: &mut impl Write,
+    node: Node,
+    depth: usize,
+    max_depth: usize,
+) -> Result<(), Error> {
+    let write = |r: std::io::Result<()>| r.map_err(|_| Error::FileWriting);
+    match node.kind() {
+        Kind::Array | Kind::Object if depth >= max_depth => Err(Error::TooDeep(max_depth)),
+        Kind::Null => write(out.write_all(b"null")),
+        Kind::Bool => write(out.write_all(if node.as_bool() == Some(true) {
+            b"true"
+        } else {
+            b"false"
+        })),
+        Kind::Number => write(out.write_all(node.as_number().unwrap_or_default().as_bytes())),
+        Kind::Str => write(write_str(out, node.as_str().unwrap_or_default())),
+        Kind::Array => {
+            write(out.write_all(b"["))?;
+            for (i, item) in node.items().enumerate() {
+                if i > 0 {
+                    write(out.write_all(b","))?;
+                }
+                write_node(out, item, depth + 1, max_depth)?;
+            }
+            write(out.write_all(b"]"))
+        }
+        Kind::Object => {
+            write(out.write_all(b"{"))?;
+            for (i, (key, value)) in node.entries().enumerate() {
+                if i > 0 {
+                    write(out.write_all(b","))?;
+                }
+                write(write_str(out, key))?;
+                write(out.write_all(b":"))?;
+                write_node(out, value, depth + 1, max_depth)?;
+            }
+            write(out.write_all(b"}"))
+        }
+    }
+}
+
+struct Differ<'w, W: Write> {
+    hashes: (Vec<u64>, Vec<u64>),
+    path: String, // Json pointer of the values being compared
+    ops: usize,
+    max_depth: usize,
+    out: &'w mut W,
+}
+
+impl<W: Write> Differ<'_, W> {
+    /// Values are first told apart by their hash, and only compared when
+    /// it matches, since different values may share it. `depth` is the
+    /// number of containers around them, values too deep to be compared
+    /// differ, for `diff` to report it.
+    fn equal(&self, a: Node, b: Node, depth: usize) -> bool {
+        if self.hashes.0[a.id()] != self.hashes.1[b.id()] || a.kind() != b.kind() {
+            return false;
+        }
+        match a.kind() {
+            Kind::Array | Kind::Object if depth >= self.max_depth => false,
+            Kind::Null => true,
+            Kind::Bool => a.as_bool() == b.as_bool(),
+            Kind::Number => a.as_number() == b.as_number(),
+            Kind::Str => a.as_str() == b.as_str(),
+            Kind::Array => {
+                a.len() == b.len()
+                    && (a.items().zip(b.items())).all(|(x, y)| self.equal(x, y, depth + 1))
+            }
+            Kind::Object => {
+                if a.len() != b.len() {
+                    return false;
+                }
+                // Members usually come in the same order, otherwise they
+                // are looked up
+                let mut map: Option<HashMap<&str, Node>> = None;
+                for ((key, x), (other, y)) in a.entries().zip(b.entries()) {
+                    let y = match key == other {
+                        true => Some(y),
+                        false if b.len() > MAP_MIN_LEN => {
+                            map.get_or_insert_with(|| members(b)).get(key).copied()
+                        }
+                        false => b.get(key),
+                    };
+                    if !y.is_some_and(|y| self.equal(x, y, depth + 1)) {
+                        return false;
+                    }
+                }
+                true
+            }
+        }
+    }
+
+    /// Writes an operation at the current path, its value being `depth`
+    /// containers deep.
+    fn op(&mut self, op: &str, value: Option<Node>, depth: usize) -> Result<(), Error> {
+        let sep = if self.ops == 0 { "\n" } else { ",\n" };
+        self.ops += 1;
+        let write = |r: std::io::Result<()>| r.map_err(|_| Error::FileWriting);
+        write(write!(self.out, "{sep}{{\"op\":\"{op}\",\"path\":"))?;
+        write(write_str(self.out, &self.path))?;
+        if let Some(value) = value {
+            write(self.out.write_all(b",\"value\":"))?;
+            write_node(self.out, value, depth, self.max_depth)?;
+        }
+        write(self.out.write_all(b"}"))
+    }
+
+    fn diff(&mut self, a: Node, b: Node, depth: usize) -> Result<(), Error> {
+        if self.equal(a, b, depth) {
+            return Ok(());
+        }
+        match (a.kind(), b.kind()) {
+            // Snapshots may not come from a parser which limited their depth
+            (Kind::Object, Kind::Object) | (Kind::Array, Kind::Array)
+                if depth >= self.max_depth =>
+            {
+                Err(Error::TooDeep(self.max_depth))
+            }
+            (Kind::Object, Kind::Object) => self.diff_objects(a, b, depth),
+            (Kind::Array, Kind::Array) => self.diff_arrays(a, b, depth),
+            _ => self.op("replace", Some(b), depth),
+        }
+    }
+
+    fn diff_objects(&mut self, a: Node, b: Node, depth: usize) -> Result<(), Error> {
+        let map: Option<HashMap<&str, Node>> = (b.len() > MAP_MIN_LEN).then(|| members(b));
+        let find = |key: &str| match &map {
+            Some(map) => map.get(key).copied(),
+            None => b.get(key),
+        };
+
+        let len = self.path.len();
+        for (key, value) in a.entries() {
+            push_token(&mut self.path, key);
+            match find(key) {
+                Some(other) => self.diff(value, other, depth + 1)?,
+                None => self.op("remove", None, depth + 1)?,
+            }
+            self.path.truncate(len);
+        }
+
+        let map: Option<HashMap<&str, Node>> = (a.len() > MAP_MIN_LEN).then(|| members(a));
+        for (key, value) in b.entries() {
+            let known = match &map {
+                Some(map) => map.contains_key(key),
+                None => a.get(key).is_some(),
+            };
+            if !known {
+                push_token(&mut self.path, key);
+                self.op("add", Some(value), depth + 1)?;
+                self.path.truncate(len);
+            }
+        }
+        Ok(())
+    }
+
+    fn diff_arrays(&mut self, a: Node, b: Node, depth: usize) -> Result<(), Error> {
+        let items_a: Vec<Node> = a.items().collect();
+        let items_b: Vec<Node> = b.items().collect();
+        let prefix = items_a
+            .iter()
+            .zip(&items_b)
+            .take_while(|(x, y)| self.equal(**x, **y, depth + 1))
+            .count();
+        let suffix = items_a[prefix..]
+            .iter()
+            .rev()
+            .zip(items_b[prefix..].iter().rev())
+            .take_while(|(x, y)| self.equal(**x, **y, depth + 1))
+            .count();
+        let middle_a = &items_a[prefix..items_a.len() - suffix];
+        let middle_b = &items_b[prefix..items_b.len() - suffix];
+
+        let len = self.path.len();
+        let common = middle_a.len().min(middle_b.len());
+        for i in 0..common {
+            push_token(&mut self.path, &(prefix + i).to_string());
+            self.diff(middle_a[i], middle_b[i], depth + 1)?;
+            self.path.truncate(len);
+        }
+        for (i, item) in middle_b.iter().enumerate().skip(common) {
+            push_token(&mut self.path, &(prefix + i).to_string());
+            self.op("add", Some(*item), depth + 1)?;
+            self.path.truncate(len);
+        }
+        // Removing at the same index shifts the next ones into place
+        push_token(&mut self.path, &(prefix + common).to_string());
+        for _ in common..middle_a.len() {
+            self.op("remove", None, depth + 1)?;
+        }
+        self.path.truncate(len);
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{diff, diff_with_depth, Differ};
+    use crate::{analyse, compile, Error, Snapshot, DEFAULT_MAX_DEPTH};
+
+    fn patch(a: &str, b: &str) -> String {
+        let a = compile(&analyse(a.to_string()).unwrap()).unwrap();
+        let b = compile(&analyse(b.to_string()).unwrap()).unwrap();
+        let mut out = Vec::new();
+        diff(
+            &Snapshot::new(&a).unwrap(),
+            &Snapshot::new(&b).unwrap(),
+            &mut out,
+        )
+        .unwrap();
+        String::from_utf8(out).unwrap()
+    }
+
+    #[test]
+    fn test_diff_objects() {
+        assert_eq!(
+            patch(r#"{"a": 1, "b": [1, 2]}"#, r#"{"b": [1, 2], "a": 1}"#),
+            "[]\n"
+        );
+        assert_eq!(
+            patch(
+                r#"{"a": 1, "b": {"c": "x", "d/e": true}, "f": null}"#,
+                r#"{"a": 2, "b": {"c": "x\n", "d/e": true}, "g~": {"h": []}}"#
+            ),
+            concat!(
+                "[\n",
+                r#"{"op":"replace","path":"/a","value":2},"#,
+                "\n",
+                r#"{"op":"replace","path":"/b/c","value":"x\n"},"#,
+                "\n",
+                r#"{"op":"remove","path":"/f"},"#,
+                "\n",
+                r#"{"op":"add","path":"/g~0","value":{"h":[]}}"#,
+                "\n]\n"
+            )
+        );
+    }
+
+    #[test]
+    fn test_diff_arrays() {
+        let ops = |a: &str, b: &str| {
+            patch(a, b)
+                .lines()
+                .filter(|l| l.starts_with('{'))
+                .map(|l| l.trim_end_matches(',').to_string())
+                .collect::<Vec<_>>()
+        };
+        assert_eq!(
+            ops("[1, 2, 3, 4]", "[1, 2, 9, 3, 4]"),
+            vec![r#"{"op":"add","path":"/2","value":9}"#]
+        );
+        assert_eq!(
+            ops("[1, 2, 3, 4]", "[1, 4]"),
+            vec![
+                r#"{"op":"remove","path":"/1"}"#,
+                r#"{"op":"remove","path":"/1"}"#
+            ]
+        );
+        assert_eq!(
+            ops(r#"[{"a": 1}, 5]"#, r#"[{"a": 2}, 5]"#),
+            vec![r#"{"op":"replace","path":"/0/a","value":2}"#]
+        );
+        assert_eq!(
+            ops(r#"{"x": [1]}"#, r#"{"x": "1"}"#),
+            vec![r#"{"op":"replace","path":"/x","value":"1"}"#]
+        );
+    }
+
+    #[test]
+    fn test_diff_root() {
+        assert_eq!(
+            patch("[1]", r#"{"": [1]}"#),
+            concat!(
+                "[\n",
+                r#"{"op":"replace","path":"","value":{"":[1]}}"#,
+                "\n]\n"
+            )
+        );
+        assert_eq!(
+            patch(r#"{"": [1]}"#, r#"{"": [2]}"#),
+            concat!("[\n", r#"{"op":"replace","path":"//0","value":2}"#, "\n]\n")
+        );
+        assert_eq!(
+            patch("[1]", r#"{"x": 1}"#),
+            concat!(
+                "[\n",
+                r#"{"op":"replace","path":"","value":{"x":1}}"#,
+                "\n]\n"
+            )
+        );
+    }
+
+    #[test]
+    fn test_diff_numbers() {
+        // Compared and written as their text, not as f64
+        assert_eq!(
+            patch(
+                r#"{"id": 12345678901234567891, "x": 1}"#,
+                r#"{"id": 12345678901234567892, "x": 1e400}"#
+            ),
+            concat!(
+                "[\n",
+                r#"{"op":"replace","path":"/id","value":12345678901234567892},"#,
+                "\n",
+                r#"{"op":"replace","path":"/x","value":1e400}"#,
+                "\n]\n"
+            )
+        );
+    }
+
+    #[test]
+    fn test_diff_max_depth() {
+        let diff_deep = |a: &str, b: &str, max_depth| {
+            let a = compile(&analyse(a.to_string()).unwrap()).unwrap();
+            let b = compile(&analyse(b.to_string()).unwrap()).unwrap();
+            let (a, b) = (Snapshot::new(&a).unwrap(), Snapshot::new(&b).unwrap());
+            diff_with_depth(&a, &b, max_depth, &mut Vec::new())
+        };
+        assert!(diff_deep("[[[1]]]", "[[[2]]]", 3).is_ok());
+        assert!(matches!(
+            diff_deep("[[[1]]]", "[[[2]]]", 2),
+            Err(Error::TooDeep(2))
+        ));
+        // The values written are bounded as well
+        assert!(diff_deep("[1]", "[[[[1]]]]", 4).is_ok());
+        assert!(matches!(
+            diff_deep("[1]", "[[[[1]]]]", 2),
+            Err(Error::TooDeep(2))
+        ));
+    }
+
+    #[test]
+    fn test_diff_hash_collision() {
+        let compiled = |json: &str| compile(&analyse(json.to_string()).unwrap()).unwrap();
+        let a = compiled(r#"{"a": [1, {"b": "x"}], "c": true}"#);
+        let b = compiled(r#"{"c": true, "a": [1, {"b": "y"}]}"#);
+        let c = compiled(r#"{"c": true, "a": [1, {"b": "x"}]}"#);
+        let (a, b, c) = (
+            Snapshot::new(&a).unwrap(),
+            Snapshot::new(&b).unwrap(),
+            Snapshot::new(&c).unwrap(),
+        );
+
+        // Every value colliding, only the comparison tells them apart
+        fn colliding<'w>(x: &Snapshot, y: &Snapshot, out: &'w mut Vec<u8>) -> Differ<'w, Vec<u8>> {
+            Differ {
+                hashes: (vec![0; x.node_count()], vec![0; y.node_count()]),
+                path: String::new(),
+                ops: 0,
+                max_depth: DEFAULT_MAX_DEPTH,
+                out,
+            }
+        }
+        let mut out = Vec::new();
+        assert!(!colliding(&a, &b, &mut out).equal(a.root(), b.root(), 0));
+        assert!(colliding(&a, &c, &mut out).equal(a.root(), c.root(), 0));
+    }
+}
@@ -16,6 +16,51 @@ pub enum Error {
     MissingValue,
     ExtraValue,
     LineBreakInLitteral,
+    ControlCharInLitteral(char),
+    InvalidEscape(char),
+    InvalidUtf8,
+    TooDeep(usize),
+    NoFileProvided,
+    BadOption(String),
+    FileUnreadable,
+    FileWriting,
+    InvalidSnapshot,
+    SnapshotTooLarge,
+    MissingField(&'static str),
+    DuplicateKey(String),
+    InvalidQuery(String),
+    At(Position, Box<Error>),
+}
+
+/// Location of an error in the input, line and column start at 1.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Position {
+    pub offset: usize,
+    pub line: usize,
+    pub column: usize,
+}
+
+impl Position {
+    /// Computes the line and column of `offset`, only done once an error
+    /// occured so that the happy path doesn't have to track them.
+    pub fn locate(input: &[u8], offset: usize) -> Self {
+        let offset = offset.min(input.len());
+        let before = &input[..offset];
+        let line_start = before
+            .iter()
+            .rposition(|b| *b == b'\n')
+            .map_or(0, |i| i + 1);
+        Position {
+            offset,
+            line: before.iter().filter(|b| **b == b'\n').count() + 1,
+            // Count chars, not bytes: skip utf8 continuation bytes
+            column: before[line_start..]
+                .iter()
+                .filter(|b| (**b & 0xC0) != 0x80)
+                .count()
+                + 1,
+        }
+    }
 }
 
 impl Debug for Error {
@@ -44,6 +89,37 @@ impl Debug for Error {
             Error::LineBreakInLitteral => {
                 writeln!(f, "Error: line break in str value is not allowed")
             }
+            Error::ControlCharInLitteral(c) => {
+                writeln!(f, "Error: control char {c:?} in str value must be escaped")
+            }
+            Error::InvalidEscape(c) => writeln!(f, "Error: \\{c} is not a valid escape"),
+            Error::InvalidUtf8 => writeln!(f, "Error: the input is not valid utf8"),
+            Error::TooDeep(max) => {
+                writeln!(f, "Error: containers are nested deeper than {max} levels")
+            }
+            Error::NoFileProvided => writeln!(f, "Error: no file provided."),
+            Error::BadOption(o) => writeln!(f, "Error: option {o} not recognized."),
+            Error::FileUnreadable => writeln!(f, "Error: the provided file is unreadable."),
+            Error::FileWriting => writeln!(f, "Error: unable to write the output file."),
+            Error::InvalidSnapshot => writeln!(f, "Error: not a valid compiled json file."),
+            Error::SnapshotTooLarge => {
+                writeln!(
+                    f,
+                    "Error: a string, array or object is too long to be compiled."
+                )
+            }
+            Error::MissingField(name) => writeln!(f, "Error: missing field \"{name}\"."),
+            Error::DuplicateKey(key) => {
+                writeln!(f, "Error: key \"{key}\" appears twice in an object.")
+            }
+            Error::InvalidQuery(q) => writeln!(f, "Error: {q} is not a valid query."),
+            Error::At(p, e) => {
+                write!(
+                    f,
+                    "line {}, column {} (byte {}): {e:?}",
+                    p.line, p.column, p.offset
+                )
+            }
         }
     }
 }
@@ -0,0 +1,462 @@
+extern crate self as json;
+
+use crate::strings::unescape;
+
+pub use crate::diff::{diff, diff_with_depth};
+pub use crate::error::{Error, Position};
+pub use crate::mmap::Mmap;
+pub use crate::number::Number;
+pub use crate::object::Object;
+pub use crate::parallel::analyse_parallel;
+pub use crate::parser::{Builder, Parser, DEFAULT_MAX_DEPTH};
+pub use crate::push::{Progress, PushParser};
+pub use crate::select::{select, Format, Query};
+pub use crate::snapshot::{compile, Kind, Node, Snapshot};
+pub use crate::strings::validate_utf8;
+pub use crate::symbols::{Symbol, SymbolTable};
+pub use crate::typed::{from_str, Cursor, FromJson};
+pub use crate::validate::{validate, validate_with_depth};
+pub use json_derive::FromJson;
+
+mod diff;
+mod error;
+mod mmap;
+mod number;
+mod object;
+mod parallel;
+mod parser;
+mod push;
+mod select;
+mod snapshot;
+mod strings;
+mod symbols;
+mod typed;
+mod validate;
+
+#[derive(Debug)]
+pub enum Token {
+    OpenBracket,
+    CloseBracket,
+    Comma,
+    Colon,
+    Litteral(String),
+    True,
+    False,
+    Null,
+    Number(Number),
+    OpenList,
+    CloseList,
+}
+
+#[derive(Debug, PartialEq)]
+pub enum Value {
+    Null,
+    Bool(bool),
+    Number(Number),
+    Str(String),
+    Array(Vec<Value>),
+    Object(Object),
+}
+
+/// Object member, the key is interned in the `SymbolTable` of the document.
+#[derive(PartialEq, Debug)]
+pub struct KV(pub Symbol, pub Value);
+
+/// A parsed json, along with the table its object keys are interned in.
+#[derive(Debug)]
+pub struct Document {
+    pub symbols: SymbolTable,
+    pub root: Object,
+    /// Whether the document is a top-level array, which `root` then holds
+    /// under the "" key.
+    pub is_array: bool,
+}
+
+impl Document {
+    /// Top-level arrays are stored under the "" key.
+    pub(crate) fn from_value(mut symbols: SymbolTable, value: Value) -> Self {
+        match value {
+            Value::Object(root) => Document {
+                symbols,
+                root,
+                is_array: false,
+            },
+            v => {
+                let mut root = Object::new();
+                root.push(KV(symbols.intern(""), v));
+                Document {
+                    symbols,
+                    root,
+                    is_array: true,
+                }
+            }
+        }
+    }
+
+    pub fn key(&self, kv: &KV) -> &str {
+        self.symbols.resolve(kv.0)
+    }
+
+    /// Looks `key` up in `object`, which must belong to this document.
+    pub fn get<'a>(&self, object: &'a Object, key: &str) -> Option<&'a Value> {
+        object.get(self.symbols.get(key)?)
+    }
+}
+
+fn read_end_word(
+    end_of_word: &str,
+    iter: &mut impl Iterator<Item = (usize, char)>,
+) -> Result<(), Error> {
+    for c in end_of_word.chars() {
+        match (c, iter.next()) {
+            (a, Some((i, b))) => {
+                if a != b {
+                    return Err(Error::UnrecognizedToken(b, i));
+                }
+            }
+            _ => {
+                return Err(Error::ParsingError);
+            }
+        }
+    }
+    Ok(())
+}
+
+/// Splits `input` into tokens, handed to `emit` as soon as they are read so
+/// that they never pile up, and stops at the first error either returns.
+pub(crate) fn tokenize(
+    input: &str,
+    mut emit: impl FnMut(Token) -> Result<(), Error>,
+) -> Result<(), Error> {
+    let mut iter = input.chars().enumerate();
+    while let Some((i, ch)) = iter.next() {
+        match ch {
+            '{' => emit(Token::OpenBracket)?,
+            '}' => emit(Token::CloseBracket)?,
+            '[' => emit(Token::OpenList)?,
+            ']' => emit(Token::CloseList)?,
+            ',' => emit(Token::Comma)?,
+            ':' => emit(Token::Colon)?,
+            '"' => {
+                let mut l = String::new();
+                loop {
+                    match iter.next() {
+                        Some((_, c)) => {
+                            if c == '"' {
+                                break;
+                            } else if c == '\\' {
+                                l.push(c);
+                                match iter.next() {
+                                    Some((_, c)) => l.push(c),
+                                    None => return Err(Error::MismatchQuote),
+                                }
+                            } else if c == '\n' {
+                                return Err(Error::LineBreakInLitteral);
+                            } else if c < ' ' {
+                                return Err(Error::ControlCharInLitteral(c));
+                            } else {
+                                l.push(c);
+                            }
+                        }
+                        None => return Err(Error::MismatchQuote),
+                    }
+                }
+                if l.contains('\\') {
+                    l = unescape(&l)?.into_owned();
+                }
+                emit(Token::Litteral(l))?
+            }
+            't' => match read_end_word("rue", &mut iter) {
+                Ok(()) => emit(Token::True)?,
+                Err(e) => return Err(e),
+            },
+            'f' => match read_end_word("alse", &mut iter) {
+                Ok(()) => emit(Token::False)?,
+                Err(e) => return Err(e),
+            },
+            'n' => match read_end_word("ull", &mut iter) {
+                Ok(()) => emit(Token::Null)?,
+                Err(e) => return Err(e),
+            },
+            '\u{0020}' | '\u{000A}' | '\u{000D}' | '\u{0009}' => continue, // Ignore whitespaces, tabs, ...
+            c @ '-' | c @ '0'..='9' => match tokenize_digits(c, &mut iter) {
+                Ok(n) => emit(Token::Number(n))?,
+                Err(e) => return Err(e),
+            },
+            _ => return Err(Error::UnrecognizedToken(ch, i)),
+        }
+    }
+    Ok(())
+}
+
+fn tokenize_digits(
+    c: char,
+    iter: &mut std::iter::Enumerate<std::str::Chars<'_>>,
+) -> Result<Number, Error> {
+    let mut peekable = iter.clone().peekable();
+    let mut s = String::new();
+    s.push(c);
+
+    while let Some((_, ch)) = peekable.peek() {
+        if !"0123456789Ee.+-".contains(*ch) {
+            break;
+        }
+        peekable.next();
+        s.push(iter.next().unwrap().1)
+    }
+
+    Number::parse(&s)
+}
+
+pub fn analyse(raw: String) -> Result<Document, Error> {
+    analyse_with_depth(raw, DEFAULT_MAX_DEPTH)
+}
+
+/// Same as `analyse`, failing on containers nested deeper than `max_depth`.
+pub fn analyse_with_depth(raw: String, max_depth: usize) -> Result<Document, Error> {
+    analyse_str(&raw, max_depth)
+}
+
+/// Same as `analyse_with_depth`, for input that still has to be checked
+/// for utf8.
+pub fn analyse_bytes(raw: &[u8], max_depth: usize) -> Result<Document, Error> {
+    analyse_str(validate_utf8(raw)?, max_depth)
+}
+
+pub(crate) fn analyse_str(raw: &str, max_depth: usize) -> Result<Document, Error> {
+    let mut symbols = SymbolTable::new();
+    let mut builder = Builder::new(max_depth);
+    let mut first = true;
+    tokenize(raw, |token| {
+        if std::mem::take(&mut first) && !matches!(token, Token::OpenBracket | Token::OpenList) {
+            return Err(Error::MustBeginWithBracket);
+        }
+        builder.push(token, &mut symbols)
+    })?;
+    if first {
+        return Err(Error::MustBeginWithBracket);
+    }
+
+    Ok(Document::from_value(symbols, builder.finish()?))
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{
+        analyse, analyse_bytes, Document, Number, Object, Symbol, Value, DEFAULT_MAX_DEPTH, KV,
+    };
+
+    fn key(json: &Document, k: &str) -> Symbol {
+        json.symbols.get(k).unwrap()
+    }
+
+    fn object(kvs: Vec<KV>) -> Object {
+        let mut object = Object::new();
+        kvs.into_iter()
+            .for_each(|kv| assert!(object.push(kv).is_none()));
+        object
+    }
+
+    #[test]
+    fn test_step1_valid() {
+        let json = analyse(std::fs::read_to_string("tests/step1/valid.json").unwrap()).unwrap();
+
+        assert!(json.root.len() == 0);
+    }
+
+    #[test]
+    fn test_step1_invalid() {
+        assert!(analyse(std::fs::read_to_string("tests/step1/invalid.json").unwrap()).is_err());
+    }
+
+    #[test]
+    fn test_step2_valid() {
+        let json = analyse(std::fs::read_to_string("tests/step2/valid.json").unwrap()).unwrap();
+
+        assert_eq!(
+            json.root[0],
+            KV(key(&json, "key"), Value::Str("value".to_string()))
+        );
+    }
+
+    #[test]
+    fn test_step2_valid2() {
+        let json = analyse(std::fs::read_to_string("tests/step2/valid2.json").unwrap()).unwrap();
+
+        assert_eq!(
+            json.root[0],
+            KV(key(&json, "key"), Value::Str("value".to_string()))
+        );
+        assert_eq!(
+            json.root[1],
+            KV(key(&json, "key2"), Value::Str("value".to_string()))
+        );
+    }
+
+    #[test]
+    fn test_step2_invalid() {
+        assert!(analyse(std::fs::read_to_string("tests/step2/invalid.json").unwrap()).is_err());
+    }
+
+    #[test]
+    fn test_step2_invalid2() {
+        assert!(analyse(std::fs::read_to_string("tests/step2/invalid2.json").unwrap()).is_err());
+    }
+
+    #[test]
+    fn test_step3_valid() {
+        let json = analyse(std::fs::read_to_string("tests/step3/valid.json").unwrap()).unwrap();
+
+        assert_eq!(json.root[0], KV(key(&json, "key1"), Value::Bool(true)));
+        assert_eq!(json.root[1], KV(key(&json, "key2"), Value::Bool(false)));
+        assert_eq!(json.root[2], KV(key(&json, "key3"), Value::Null));
+        assert_eq!(
+            json.root[3],
+            KV(key(&json, "key4"), Value::Str("value".to_string()))
+        );
+        assert_eq!(
+            json.root[4],
+            KV(key(&json, "key5"), Value::Number(Number::from(101)))
+        );
+    }
+
+    #[test]
+    fn test_step3_invalid() {
+        assert!(analyse(std::fs::read_to_string("tests/step3/invalid.json").unwrap()).is_err());
+    }
+
+    #[test]
+    fn test_step4_valid() {
+        let json = analyse(std::fs::read_to_string("tests/step4/valid.json").unwrap()).unwrap();
+
+        assert_eq!(
+            json.root[0],
+            KV(key(&json, "key"), Value::Str("value".to_string()))
+        );
+        assert_eq!(
+            json.root[1],
+            KV(key(&json, "key-n"), Value::Number(Number::from(101)))
+        );
+        assert_eq!(
+            json.root[2],
+            KV(key(&json, "key-o"), Value::Object(Object::new()))
+        );
+        assert_eq!(
+            json.root[3],
+            KV(key(&json, "key-l"), Value::Array(Vec::new()))
+        );
+    }
+
+    #[test]
+    fn test_step4_valid2() {
+        let json = analyse(std::fs::read_to_string("tests/step4/valid2.json").unwrap()).unwrap();
+
+        assert_eq!(
+            json.root[0],
+            KV(key(&json, "key"), Value::Str("value".to_string()))
+        );
+        assert_eq!(
+            json.root[1],
+            KV(key(&json, "key-n"), Value::Number(Number::from(101)))
+        );
+        assert_eq!(
+            json.root[2],
+            KV(
+                key(&json, "key-o"),
+                Value::Object(object(vec![KV(
+                    key(&json, "inner key"),
+                    Value::Str("inner value".to_string())
+                )]))
+            )
+        );
+        assert_eq!(
+            json.root[3],
+            KV(
+                key(&json, "key-l"),
+                Value::Array(vec![(Value::Str("list value".to_string()))])
+            )
+        );
+    }
+
+    #[test]
+    fn test_step4_invalid() {
+        assert!(analyse(std::fs::read_to_string("tests/step4/invalid.json").unwrap()).is_err());
+    }
+
+    #[test]
+    fn test_interned_keys() {
+        let json =
+            analyse(r#"[{"id": 1, "name": "a"}, {"id": 2, "name": "b"}]"#.to_string()).unwrap();
+
+        // The top-level array is stored under the "" key
+        assert_eq!(json.symbols.len(), 3);
+        match &json.root[0].1 {
+            Value::Array(records) => {
+                for record in records {
+                    match record {
+                        Value::Object(o) => {
+                            assert_eq!(o[0].0, key(&json, "id"));
+                            assert_eq!(o[1].0, key(&json, "name"));
+                            assert_eq!(json.key(&o[1]), "name");
+                        }
+                        _ => panic!("expected an object"),
+                    }
+                }
+            }
+            _ => panic!("expected an array"),
+        }
+    }
+
+    #[test]
+    fn test_step5_fails() {
+        std::fs::read_dir("tests/step5/")
+            .unwrap()
+            .filter(|dir_entry| {
+                dir_entry
+                    .as_ref()
+                    .unwrap()
+                    .file_name()
+                    .to_str()
+                    .unwrap()
+                    .starts_with("fail")
+            })
+            .for_each(|dir_entry| {
+                assert!(
+                    analyse(std::fs::read_to_string(dir_entry.as_ref().unwrap().path()).unwrap())
+                        .is_err(),
+                    "Failed on file {}",
+                    dir_entry.unwrap().file_name().to_str().unwrap()
+                )
+            })
+    }
+
+    #[test]
+    fn test_step5_pass1() {
+        analyse(std::fs::read_to_string("tests/step5/pass1.json").unwrap()).unwrap();
+    }
+
+    #[test]
+    fn test_escapes_decoded() {
+        let json =
+            analyse(r#"{"a\u0062": "\"\\\/\b\f\n\r\t", "e": "\u00e9\uD83D\uDE00"}"#.to_string())
+                .unwrap();
+        assert_eq!(json.key(&json.root[0]), "ab");
+        assert_eq!(
+            json.root[0].1,
+            Value::Str("\"\\/\u{8}\u{c}\n\r\t".to_string())
+        );
+        assert_eq!(json.root[1].1, Value::Str("é😀".to_string()));
+        assert!(analyse(r#"{"a": "\uD83D"}"#.to_string()).is_err());
+        assert!(analyse_bytes(b"{\"a\": \"\xC3\"}", DEFAULT_MAX_DEPTH).is_err());
+    }
+
+    #[test]
+    fn test_step5_pass2() {
+        analyse(std::fs::read_to_string("tests/step5/pass2.json").unwrap()).unwrap();
+    }
+
+    #[test]
+    fn test_step5_pass3() {
+        analyse(std::fs::read_to_string("tests/step5/pass3.json").unwrap()).unwrap();
+    }
+}
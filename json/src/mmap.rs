@@ -0,0 +1,114 @@
+use std::ops::Deref;
+
+use crate::error::Error;
+
+/// Contents of a file, memory mapped where possible.
+///
+/// Mapping saves copying the whole file before parsing starts, and the
+/// pages are only loaded, then dropped by the kernel, as the parser goes
+/// through them. Anything but a non-empty regular file on unix (a pipe,
+/// another platform) is read in memory instead.
+///
+/// As with any mapping, the file must not be truncated while it is mapped.
+pub struct Mmap {
+    map: Option<(*mut u8, usize)>,
+    data: Vec<u8>,
+}
+
+// SAFETY: the mapping is read-only and owned by this value
+unsafe impl Send for Mmap {}
+unsafe impl Sync for Mmap {}
+
+#[cfg(unix)]
+mod sys {
+    use std::ffi::c_void;
+
+    pub const PROT_READ: i32 = 1;
+    pub const MAP_PRIVATE: i32 = 2;
+    pub const MADV_SEQUENTIAL: i32 = 2;
+    pub const MAP_FAILED: *mut c_void = !0 as *mut c_void;
+
+    extern "C" {
+        pub fn mmap(
+            addr: *mut c_void,
+            len: usize,
+            prot: i32,
+            flags: i32,
+            fd: i32,
+            offset: i64,
+        ) -> *mut c_void;
+        pub fn munmap(addr: *mut c_void, len: usize) -> i32;
+        pub fn madvise(addr: *mut c_void, len: usize, advice: i32) -> i32;
+    }
+}
+
+impl Mmap {
+    pub fn open(path: &str) -> Result<Self, Error> {
+        let mut file = std::fs::File::open(path).map_err(|_| Error::FileUnreadable)?;
+        let metadata = file.metadata().map_err(|_| Error::FileUnreadable)?;
+
+        #[cfg(unix)]
+        if metadata.is_file() && metadata.len() > 0 {
+            use std::os::unix::io::AsRawFd;
+
+            let len = metadata.len() as usize;
+            // SAFETY: a new private read-only mapping of the whole file,
+            // the mapping keeps the file open by itself
+            let ptr = unsafe {
+                sys::mmap(
+                    std::ptr::null_mut(),
+                    len,
+                    sys::PROT_READ,
+                    sys::MAP_PRIVATE,
+                    file.as_raw_fd(),
+                    0,
+                )
+            };
+            if ptr != sys::MAP_FAILED {
+                // Only a hint: read ahead aggressively, drop pages once read
+                unsafe { sys::madvise(ptr, len, sys::MADV_SEQUENTIAL) };
+                return Ok(Mmap {
+                    map: Some((ptr as *mut u8, len)),
+                    data: Vec::new(),
+                });
+            }
+        }
+
+        let mut data = Vec::with_capacity(metadata.len() as usize);
+        std::io::Read::read_to_end(&mut file, &mut data).map_err(|_| Error::FileUnreadable)?;
+        Ok(Mmap { map: None, data })
+    }
+}
+
+impl Deref for Mmap {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self.map {
+            // SAFETY: the mapping is valid for `len` bytes until dropped
+            Some((ptr, len)) => unsafe { std::slice::from_raw_parts(ptr, len) },
+            None => &self.data,
+        }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        if let Some((ptr, len)) = self.map {
+            unsafe { sys::munmap(ptr as *mut _, len) };
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Mmap;
+
+    #[test]
+    fn test_mmap() {
+        let map = Mmap::open("tests/step5/pass1.json").unwrap();
+        assert_eq!(&*map, std::fs::read("tests/step5/pass1.json").unwrap());
+        assert!(Mmap::open("tests/missing.json").is_err());
+    }
+}
@@ -0,0 +1,148 @@
+use std::fmt::{Debug, Display};
+
+use crate::error::Error;
+use crate::validate::scan_number;
+
+/// Longest text kept inline, this keeps `Number`, and `Value`, as small as
+/// when it held an `f64` and its padding.
+const INLINE_LEN: usize = 21;
+
+/// A json number, kept as the text it was written with.
+///
+/// It is only converted when read, with `as_f64`, `as_i64` or `as_u64`,
+/// so numbers nobody reads cost no conversion, and `as_str` gives back
+/// the exact text whatever its precision (amounts of money, 64 bits ids).
+/// Whether the text is an integer is recorded when it is parsed.
+#[derive(Clone)]
+pub struct Number(Repr);
+
+#[derive(Clone)]
+enum Repr {
+    Inline {
+        integer: bool,
+        len: u8,
+        bytes: [u8; INLINE_LEN],
+    },
+    Heap {
+        integer: bool,
+        text: Box<str>,
+    },
+}
+
+impl Number {
+    /// Checks that `text` is a json number and keeps it as is.
+    pub fn parse(text: &str) -> Result<Self, Error> {
+        match scan_number(text.as_bytes(), 0) {
+            Ok(last) if last + 1 == text.len() => (),
+            _ => return Err(Error::InvalidNumber),
+        }
+        let integer = !text.bytes().any(|b| matches!(b, b'.' | b'e' | b'E'));
+        Ok(Number(if text.len() <= INLINE_LEN {
+            let mut bytes = [0; INLINE_LEN];
+            bytes[..text.len()].copy_from_slice(text.as_bytes());
+            Repr::Inline {
+                integer,
+                len: text.len() as u8,
+                bytes,
+            }
+        } else {
+            Repr::Heap {
+                integer,
+                text: text.into(),
+            }
+        }))
+    }
+
+    /// The number as written in the document.
+    pub fn as_str(&self) -> &str {
+        match &self.0 {
+            // SAFETY: the bytes were copied from a str, and are all ascii
+            Repr::Inline { len, bytes, .. } => unsafe {
+                std::str::from_utf8_unchecked(&bytes[..*len as usize])
+            },
+            Repr::Heap { text, .. } => text,
+        }
+    }
+
+    /// True if written without a fraction nor an exponent.
+    pub fn is_integer(&self) -> bool {
+        match self.0 {
+            Repr::Inline { integer, .. } | Repr::Heap { integer, .. } => integer,
+        }
+    }
+
+    /// Nearest `f64`, infinite if out of its range.
+    pub fn as_f64(&self) -> f64 {
+        // The grammar was checked already, parsing can't fail
+        self.as_str().parse().unwrap_or(f64::NAN)
+    }
+
+    /// The value if it is an integer which fits.
+    pub fn as_i64(&self) -> Option<i64> {
+        self.is_integer().then(|| self.as_str().parse().ok())?
+    }
+
+    pub fn as_u64(&self) -> Option<u64> {
+        self.is_integer().then(|| self.as_str().parse().ok())?
+    }
+}
+
+impl From<i64> for Number {
+    fn from(n: i64) -> Self {
+        Number::parse(&n.to_string()).unwrap()
+    }
+}
+
+/// Numbers are equal if written the same way, so `1` isn't `1.0`.
+impl PartialEq for Number {
+    fn eq(&self, other: &Self) -> bool {
+        self.as_str() == other.as_str()
+    }
+}
+
+impl Debug for Number {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str(self.as_str())
+    }
+}
+
+impl Display for Number {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str(self.as_str())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Number;
+
+    #[test]
+    fn test_number() {
+        let n = Number::parse("-12").unwrap();
+        assert!(n.is_integer());
+        assert_eq!(n.as_i64(), Some(-12));
+        assert_eq!(n.as_u64(), None);
+        assert_eq!(n.as_f64(), -12.0);
+
+        let n = Number::parse("1.5e3").unwrap();
+        assert!(!n.is_integer());
+        assert_eq!(n.as_i64(), None);
+        assert_eq!(n.as_f64(), 1500.0);
+
+        // Kept exactly, beyond what an f64 holds
+        let money = "12345678901234567890.123456789";
+        let n = Number::parse(money).unwrap();
+        assert_eq!(n.as_str(), money);
+        assert_eq!(n.as_i64(), None);
+        assert_eq!(
+            Number::parse("18446744073709551615").unwrap().as_u64(),
+            Some(u64::MAX)
+        );
+
+        for invalid in [
+            "01", "1.", ".5", "-", "1e", "+1", "1.5e+", "inf", "NaN", "1 ", "",
+        ] {
+            assert!(Number::parse(invalid).is_err(), "{invalid}");
+        }
+    }
+}
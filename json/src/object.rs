@@ -0,0 +1,190 @@
+use std::ops::Deref;
+
+use crate::{Symbol, Value, KV};
+
+/// Below this many members, a lookup is a scan of the key ids, which is as
+/// fast as hashing and costs no memory.
+const INDEX_MIN_LEN: usize = 16;
+const EMPTY: u32 = u32::MAX;
+
+/// Members of a json object, in the order of the document.
+///
+/// It derefs to a slice of `KV`. Objects with more than a few members also
+/// get an open-addressing index from key to position, so `get` stays
+/// constant time on maps with many keys. The index lives behind a box to
+/// keep small objects, and thus every `Value`, as small as before.
+#[derive(Debug, Default)]
+pub struct Object {
+    kvs: Vec<KV>,
+    index: Option<Box<Index>>,
+}
+
+#[derive(Debug)]
+struct Index {
+    slots: Vec<u32>, // Positions in `kvs`, the length is a power of two
+}
+
+/// Spreads the dense symbol ids over the table (Fibonacci hashing).
+fn slot_of(sym: Symbol, mask: usize) -> usize {
+    let h = sym.id().wrapping_mul(0x9E37_79B9);
+    (h ^ (h >> 16)) as usize & mask
+}
+
+impl Index {
+    /// Indexes `kvs`, with room for `len` members.
+    fn build(kvs: &[KV], len: usize) -> Box<Self> {
+        // Keep the load factor under 1/2 so probe sequences stay short
+        let mut index = Index {
+            slots: vec![EMPTY; (len * 2).next_power_of_two()],
+        };
+        for (i, kv) in kvs.iter().enumerate() {
+            let slot = index.probe(&kvs[..i], kv.0);
+            if index.slots[slot] == EMPTY {
+                index.slots[slot] = i as u32;
+            }
+        }
+        Box::new(index)
+    }
+
+    /// Returns the slot holding `sym`, or the empty one where it belongs.
+    fn probe(&self, kvs: &[KV], sym: Symbol) -> usize {
+        let mask = self.slots.len() - 1;
+        let mut slot = slot_of(sym, mask);
+        loop {
+            match self.slots[slot] {
+                EMPTY => return slot,
+                i if kvs[i as usize].0 == sym => return slot,
+                _ => slot = (slot + 1) & mask,
+            }
+        }
+    }
+}
+
+impl Object {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Adds a member, and returns the position of the first member with the
+    /// same key if there is one. Both are kept, since RFC 8259 only says keys
+    /// should be unique, and `get` finds the first.
+    pub fn push(&mut self, kv: KV) -> Option<usize> {
+        let duplicate = match &mut self.index {
+            None if self.kvs.len() < INDEX_MIN_LEN => self.kvs.iter().position(|m| m.0 == kv.0),
+            None => {
+                self.index = Some(Index::build(&self.kvs, self.kvs.len() + 1));
+                return self.push(kv);
+            }
+            Some(index) => {
+                if (self.kvs.len() + 1) * 2 > index.slots.len() {
+                    *index = Index::build(&self.kvs, self.kvs.len() + 1);
+                }
+                let slot = index.probe(&self.kvs, kv.0);
+                match index.slots[slot] {
+                    EMPTY => {
+                        index.slots[slot] = self.kvs.len() as u32;
+                        None
+                    }
+                    i => Some(i as usize),
+                }
+            }
+        };
+        self.kvs.push(kv);
+        duplicate
+    }
+
+    /// Value of the first member whose key is `sym`.
+    pub fn get(&self, sym: Symbol) -> Option<&Value> {
+        let i = match &self.index {
+            None => self.kvs.iter().position(|kv| kv.0 == sym)?,
+            Some(index) => match index.slots[index.probe(&self.kvs, sym)] {
+                EMPTY => return None,
+                i => i as usize,
+            },
+        };
+        Some(&self.kvs[i].1)
+    }
+
+    /// Rewrites every member in place, then rebuilds the index since keys
+    /// may have changed. `f` must keep the keys distinct.
+    pub(crate) fn update(&mut self, f: impl FnMut(&mut KV)) {
+        self.kvs.iter_mut().for_each(f);
+        if self.index.is_some() {
+            self.index = Some(Index::build(&self.kvs, self.kvs.len()));
+        }
+    }
+}
+
+impl Deref for Object {
+    type Target = [KV];
+
+    fn deref(&self) -> &[KV] {
+        &self.kvs
+    }
+}
+
+impl PartialEq for Object {
+    fn eq(&self, other: &Self) -> bool {
+        self.kvs == other.kvs
+    }
+}
+
+impl<'a> IntoIterator for &'a Object {
+    type Item = &'a KV;
+    type IntoIter = std::slice::Iter<'a, KV>;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.kvs.iter()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Object;
+    use crate::{analyse, validate, Number, SymbolTable, Value, KV};
+
+    #[test]
+    fn test_object_index() {
+        let mut symbols = SymbolTable::new();
+        let mut object = Object::new();
+        for i in 0..1000 {
+            let key = symbols.intern(&format!("user_{i}"));
+            assert!(object
+                .push(KV(key, Value::Number(Number::from(i))))
+                .is_none());
+        }
+        assert!(object.index.is_some());
+        for i in 0..1000 {
+            let key = symbols.get(&format!("user_{i}")).unwrap();
+            assert_eq!(object.get(key), Some(&Value::Number(Number::from(i))));
+        }
+        let other = symbols.intern("other");
+        assert_eq!(object.get(other), None);
+
+        let dup = symbols.get("user_500").unwrap();
+        assert_eq!(object.push(KV(dup, Value::Null)), Some(500));
+        assert_eq!(object.len(), 1001);
+        assert_eq!(object.get(dup), Some(&Value::Number(Number::from(500))));
+        assert_eq!(object[1000], KV(dup, Value::Null));
+    }
+
+    #[test]
+    fn test_duplicate_keys() {
+        // Valid json, which validate accepts too: every member is kept in
+        // order, and lookups find the first one
+        let input = r#"{"a": 1, "b": 2, "a": 3}"#;
+        assert!(validate(input.as_bytes()).is_ok());
+        let small = analyse(input.to_string()).unwrap();
+        let a = small.symbols.get("a").unwrap();
+        assert_eq!(small.root.len(), 3);
+        assert_eq!(small.root[2], KV(a, Value::Number(Number::from(3))));
+        assert_eq!(small.root.get(a), Some(&Value::Number(Number::from(1))));
+
+        let members: Vec<_> = (0..100).map(|i| format!(r#""k{i}": {i}"#)).collect();
+        let large = analyse(format!("{{{}, \"k42\": 0}}", members.join(", "))).unwrap();
+        let k42 = large.symbols.get("k42").unwrap();
+        assert_eq!(large.root.len(), 101);
+        assert_eq!(large.root[100], KV(k42, Value::Number(Number::from(0))));
+        assert_eq!(large.root.get(k42), Some(&Value::Number(Number::from(42))));
+    }
+}
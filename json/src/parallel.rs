@@ -0,0 +1,202 @@
+use std::thread;
+
+use crate::error::Error;
+use crate::{analyse_str, tokenize, validate_utf8, Builder, Document, Symbol, SymbolTable};
+use crate::{Token, Value, KV};
+
+/// Below this size per thread, spawning costs more than it saves.
+const MIN_CHUNK_LEN: usize = 256 * 1024;
+
+/// Parses a document made of one big top-level array on several threads.
+///
+/// The array is split between its elements, found by a quick scan of the
+/// top-level structure, and each range is parsed by its own thread with
+/// its own symbol table. The tables are then merged and the ranges
+/// stitched into a single array.
+///
+/// Input which isn't such an array, or too small to be worth it, is parsed
+/// sequentially, like `analyse_bytes` does. Otherwise the error returned is
+/// the first one of the first range failing, located in the whole input.
+pub fn analyse_parallel(raw: &[u8], max_depth: usize, threads: usize) -> Result<Document, Error> {
+    let raw = validate_utf8(raw)?;
+    let chunks = (raw.len() / MIN_CHUNK_LEN).min(threads);
+    if chunks < 2 {
+        return analyse_str(raw, max_depth);
+    }
+    let ranges = match split_array(raw.as_bytes(), chunks) {
+        Some(ranges) => ranges,
+        None => return analyse_str(raw, max_depth),
+    };
+
+    let parsed: Vec<_> = thread::scope(|s| {
+        let handles: Vec<_> = ranges
+            .iter()
+            .map(|(start, end)| s.spawn(|| parse_elements(&raw[*start..*end], max_depth)))
+            .collect();
+        handles.into_iter().map(|h| h.join().unwrap()).collect()
+    });
+    let parsed = parsed
+        .into_iter()
+        .zip(&ranges)
+        .map(|(result, (start, _))| result.map_err(|e| shift(e, &raw[..*start])))
+        .collect::<Result<Vec<_>, _>>()?;
+
+    // Interning the tables in order gives the same ids as a sequential parse
+    let mut symbols = SymbolTable::new();
+    let remaps: Vec<Vec<Symbol>> = parsed
+        .iter()
+        .map(|(table, _)| table.iter().map(|(_, k)| symbols.intern(k)).collect())
+        .collect();
+
+    let mut parts: Vec<_> = parsed.into_iter().map(|(_, values)| values).collect();
+    thread::scope(|s| {
+        for (values, remap) in parts.iter_mut().zip(&remaps).skip(1) {
+            s.spawn(move || values.iter_mut().for_each(|v| remap_keys(v, remap)));
+        }
+    });
+
+    let mut values = Vec::with_capacity(parts.iter().map(Vec::len).sum());
+    for part in parts {
+        values.extend(part);
+    }
+    Ok(Document::from_value(symbols, Value::Array(values)))
+}
+
+/// Moves the position of an error found in a range after what precedes it.
+fn shift(e: Error, before: &str) -> Error {
+    match e {
+        Error::UnrecognizedToken(c, i) => Error::UnrecognizedToken(c, before.chars().count() + i),
+        e => e,
+    }
+}
+
+/// Parses comma separated values, as found between two brackets, the
+/// brackets counting in `max_depth`.
+fn parse_elements(raw: &str, max_depth: usize) -> Result<(SymbolTable, Vec<Value>), Error> {
+    let mut symbols = SymbolTable::new();
+    let mut builder = Builder::new(max_depth);
+    builder.push(Token::OpenList, &mut symbols)?;
+    tokenize(raw, |token| builder.push(token, &mut symbols))?;
+    builder.push(Token::CloseList, &mut symbols)?;
+    match builder.finish()? {
+        Value::Array(values) => Ok((symbols, values)),
+        _ => Err(Error::ParsingError),
+    }
+}
+
+fn remap_keys(value: &mut Value, remap: &[Symbol]) {
+    match value {
+        Value::Object(kvs) => kvs.update(|KV(key, v)| {
+            *key = remap[key.id() as usize];
+            remap_keys(v, remap);
+        }),
+        Value::Array(values) => values.iter_mut().for_each(|v| remap_keys(v, remap)),
+        _ => (),
+    }
+}
+
+/// Splits the elements of the top-level array in `input` into `chunks`
+/// ranges of similar length, excluding the brackets and the commas between
+/// two ranges. Returns None if `input` isn't a single array.
+fn split_array(input: &[u8], chunks: usize) -> Option<Vec<(usize, usize)>> {
+    let is_ws = |b: &u8| matches!(b, b' ' | b'\n' | b'\r' | b'\t');
+    let open = input.iter().position(|b| !is_ws(b))?;
+    let close = input.iter().rposition(|b| !is_ws(b))?;
+    if input[open] != b'[' || input[close] != b']' || close <= open {
+        return None;
+    }
+
+    let target = (close - open) / chunks;
+    let mut ranges = Vec::with_capacity(chunks);
+    let mut start = open + 1;
+    let mut depth = 0usize;
+    let mut i = open + 1;
+    while i < close {
+        match input[i] {
+            b'"' => {
+                i += 1;
+                while i < close && input[i] != b'"' {
+                    i += if input[i] == b'\\' { 2 } else { 1 };
+                }
+            }
+            b'[' | b'{' => depth += 1,
+            b']' | b'}' => depth = depth.checked_sub(1)?,
+            b',' if depth == 0 && i - start >= target && ranges.len() + 1 < chunks => {
+                ranges.push((start, i));
+                start = i + 1;
+            }
+            _ => (),
+        }
+        i += 1;
+    }
+    if depth != 0 || i != close {
+        return None;
+    }
+    ranges.push((start, close));
+    Some(ranges)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{analyse_parallel, split_array};
+    use crate::{analyse, analyse_with_depth, Error, DEFAULT_MAX_DEPTH};
+
+    fn records(n: usize) -> String {
+        let records: Vec<_> = (0..n)
+            .map(|i| {
+                format!(
+                    r#"{{"id": {i}, "name": "user \"{i}\"", "tags": ["a", "b{}"], "k{}": {{}}}}"#,
+                    i % 7,
+                    i % 13
+                )
+            })
+            .collect();
+        format!("[{}]", records.join(",\n"))
+    }
+
+    #[test]
+    fn test_split_array() {
+        let input = r#" [1, "a,b", [2, 3], {"c": 4}] "#;
+        let ranges: Vec<_> = split_array(input.as_bytes(), 2)
+            .unwrap()
+            .into_iter()
+            .map(|(start, end)| &input[start..end])
+            .collect();
+        assert_eq!(ranges, vec![r#"1, "a,b", [2, 3]"#, r#" {"c": 4}"#]);
+        assert!(split_array(br#"{"a": 1}"#, 2).is_none());
+        assert!(split_array(br#"[1, 2]]"#, 2).is_none());
+    }
+
+    #[test]
+    fn test_parallel_same_as_sequential() {
+        let input = records(40_000);
+        let expected = analyse(input.clone()).unwrap();
+        let json = analyse_parallel(input.as_bytes(), DEFAULT_MAX_DEPTH, 4).unwrap();
+        assert_eq!(json.root, expected.root);
+        assert_eq!(json.symbols.len(), expected.symbols.len());
+    }
+
+    #[test]
+    fn test_parallel_error() {
+        let input = records(40_000).replacen(r#""id": 30000,"#, r#""id": 30000,,"#, 1);
+        assert!(analyse_parallel(input.as_bytes(), DEFAULT_MAX_DEPTH, 4).is_err());
+
+        // Located in the whole input, as a sequential parse does
+        let input = records(40_000).replacen(r#""id": 30000,"#, r#""id": @,"#, 1);
+        let sequential = analyse(input.clone()).unwrap_err();
+        let parallel = analyse_parallel(input.as_bytes(), DEFAULT_MAX_DEPTH, 4).unwrap_err();
+        assert!(matches!(sequential, Error::UnrecognizedToken('@', _)));
+        assert_eq!(format!("{parallel:?}"), format!("{sequential:?}"));
+    }
+
+    #[test]
+    fn test_parallel_max_depth() {
+        let input = records(40_000).replacen("[\"a\", ", "[[[\"a\"]], ", 1);
+        assert!(analyse_with_depth(input.clone(), 5).is_ok());
+        assert!(analyse_parallel(input.as_bytes(), 5, 4).is_ok());
+        assert!(matches!(
+            analyse_parallel(input.as_bytes(), 4, 4),
+            Err(Error::TooDeep(4))
+        ));
+    }
+}
@@ -0,0 +1,259 @@
+use crate::error::Error;
+use crate::validate::validate_in;
+use crate::{Document, Object, PushParser, Symbol, SymbolTable, Token, Value, KV};
+
+/// Nesting depth accepted when no limit is given.
+pub const DEFAULT_MAX_DEPTH: usize = 1024;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Expect {
+    FirstValue, // Right after '[', may be closed at once
+    Value,
+    FirstKey, // Right after '{', may be closed at once
+    Key,
+    Colon,
+    AfterValue,
+}
+
+#[derive(Debug)]
+enum Frame {
+    Object(Object, Option<Symbol>),
+    Array(Vec<Value>),
+}
+
+/// Builds a value from a stream of tokens.
+///
+/// Open containers live on an explicit stack instead of the native one, so
+/// a hostile input can't overflow it: going deeper than `max_depth` is an
+/// error. Tokens are pushed one at a time, which lets the caller produce
+/// them however it likes (from a token buffer, chunk by chunk, ...).
+#[derive(Debug)]
+pub struct Builder {
+    stack: Vec<Frame>,
+    expect: Expect,
+    root: Option<Value>,
+    max_depth: usize,
+}
+
+impl Builder {
+    pub fn new(max_depth: usize) -> Self {
+        Builder {
+            stack: Vec::with_capacity(max_depth.min(64)),
+            expect: Expect::Value,
+            root: None,
+            max_depth,
+        }
+    }
+
+    pub fn depth(&self) -> usize {
+        self.stack.len()
+    }
+
+    /// True once a whole value has been read.
+    pub fn is_complete(&self) -> bool {
+        self.root.is_some()
+    }
+
+    pub fn push(&mut self, token: Token, symbols: &mut SymbolTable) -> Result<(), Error> {
+        if self.root.is_some() {
+            return Err(Error::ExtraValue);
+        }
+
+        match self.expect {
+            Expect::FirstValue | Expect::Value => match token {
+                Token::CloseList if self.expect == Expect::FirstValue => self.close(),
+                Token::OpenBracket => self.open(Frame::Object(Object::new(), None)),
+                Token::OpenList => self.open(Frame::Array(Vec::new())),
+                Token::Litteral(l) => self.complete(Value::Str(l)),
+                Token::True => self.complete(Value::Bool(true)),
+                Token::False => self.complete(Value::Bool(false)),
+                Token::Null => self.complete(Value::Null),
+                Token::Number(n) => self.complete(Value::Number(n)),
+                _ => Err(Error::SyntaxError(token, line!())),
+            },
+            Expect::FirstKey | Expect::Key => match token {
+                Token::CloseBracket if self.expect == Expect::FirstKey => self.close(),
+                Token::Litteral(key) => {
+                    if let Some(Frame::Object(_, k)) = self.stack.last_mut() {
+                        *k = Some(symbols.intern(&key));
+                    }
+                    self.expect = Expect::Colon;
+                    Ok(())
+                }
+                Token::Comma | Token::CloseBracket => Err(Error::TrailingComma),
+                _ if self.expect == Expect::Key => Err(Error::TrailingComma),
+                _ => Err(Error::SyntaxError(token, line!())),
+            },
+            Expect::Colon => match token {
+                Token::Colon => {
+                    self.expect = Expect::Value;
+                    Ok(())
+                }
+                _ => Err(Error::SyntaxError(token, line!())),
+            },
+            Expect::AfterValue => match (self.stack.last(), token) {
+                (Some(Frame::Object(..)), Token::Comma) => {
+                    self.expect = Expect::Key;
+                    Ok(())
+                }
+                (Some(Frame::Array(_)), Token::Comma) => {
+                    self.expect = Expect::Value;
+                    Ok(())
+                }
+                (Some(Frame::Object(..)), Token::CloseBracket)
+                | (Some(Frame::Array(_)), Token::CloseList) => self.close(),
+                (_, token) => Err(Error::SyntaxError(token, line!())),
+            },
+        }
+    }
+
+    /// Returns the value read, failing if it is incomplete.
+    pub fn finish(mut self) -> Result<Value, Error> {
+        self.take()
+    }
+
+    /// Same as `finish`, leaving the builder ready for `reset`.
+    pub(crate) fn take(&mut self) -> Result<Value, Error> {
+        match self.root.take() {
+            Some(v) => Ok(v),
+            None if self.stack.is_empty() || self.expect == Expect::Colon => {
+                Err(Error::MissingValue)
+            }
+            None => Err(Error::MissingClosingBracket),
+        }
+    }
+
+    /// Drops the value being built, keeping the stack allocated.
+    pub(crate) fn reset(&mut self) {
+        self.stack.clear();
+        self.expect = Expect::Value;
+        self.root = None;
+    }
+
+    fn open(&mut self, frame: Frame) -> Result<(), Error> {
+        if self.stack.len() >= self.max_depth {
+            return Err(Error::TooDeep(self.max_depth));
+        }
+        self.expect = match frame {
+            Frame::Object(..) => Expect::FirstKey,
+            Frame::Array(_) => Expect::FirstValue,
+        };
+        self.stack.push(frame);
+        Ok(())
+    }
+
+    fn close(&mut self) -> Result<(), Error> {
+        match self.stack.pop() {
+            Some(Frame::Object(kvs, _)) => self.complete(Value::Object(kvs)),
+            Some(Frame::Array(values)) => self.complete(Value::Array(values)),
+            None => Err(Error::ParsingError),
+        }
+    }
+
+    fn complete(&mut self, value: Value) -> Result<(), Error> {
+        match self.stack.last_mut() {
+            None => self.root = Some(value),
+            Some(Frame::Object(kvs, key)) => match key.take() {
+                // A repeated key is kept as another member, as validate
+                // accepts it and the baseline did, `get` finds the first
+                Some(k) => _ = kvs.push(KV(k, value)),
+                None => return Err(Error::MissingValue),
+            },
+            Some(Frame::Array(values)) => values.push(value),
+        }
+        self.expect = Expect::AfterValue;
+        Ok(())
+    }
+}
+
+/// Parsing context to reuse across many documents.
+///
+/// The container stacks and the lexer buffers are kept allocated from one
+/// document to the next, only cleared. Once they have grown to the size
+/// the documents need, `validate` doesn't allocate at all, and `parse`
+/// only allocates the document it returns.
+#[derive(Debug)]
+pub struct Parser {
+    push: PushParser,
+    stack: Vec<u8>,
+    max_depth: usize,
+}
+
+impl Default for Parser {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Parser {
+    pub fn new() -> Self {
+        Self::with_depth(DEFAULT_MAX_DEPTH)
+    }
+
+    pub fn with_depth(max_depth: usize) -> Self {
+        Parser {
+            push: PushParser::with_depth(max_depth),
+            stack: Vec::with_capacity(max_depth.min(64)),
+            max_depth,
+        }
+    }
+
+    /// Same as `validate_with_depth`.
+    pub fn validate(&mut self, input: &[u8]) -> Result<(), Error> {
+        validate_in(input, &mut self.stack, self.max_depth)
+    }
+
+    /// Parses a whole document, with the same result as `analyse`.
+    pub fn parse(&mut self, input: &[u8]) -> Result<Document, Error> {
+        self.push.reset();
+        self.push.feed(input)?;
+        self.push.take_document()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Parser;
+    use crate::{analyse, analyse_with_depth, Error};
+
+    #[test]
+    fn test_max_depth() {
+        let nested = |depth: usize| "[".repeat(depth) + &"]".repeat(depth);
+
+        assert!(analyse_with_depth(nested(10), 10).is_ok());
+        assert!(matches!(
+            analyse_with_depth(nested(11), 10),
+            Err(Error::TooDeep(10))
+        ));
+        // Must fail cleanly instead of overflowing the stack
+        assert!(matches!(analyse(nested(1_000_000)), Err(Error::TooDeep(_))));
+    }
+
+    #[test]
+    fn test_mixed_nesting() {
+        let json = analyse(r#"{"a": [{"b": [[], {}]}, 1], "c": {"d": null}}"#.to_string()).unwrap();
+        assert_eq!(json.root.len(), 2);
+        assert!(analyse(r#"{"a": [}"#.to_string()).is_err());
+        assert!(analyse(r#"{"a" 1}"#.to_string()).is_err());
+        assert!(analyse(r#"{"a": }"#.to_string()).is_err());
+    }
+
+    #[test]
+    fn test_parser_reuse() {
+        let mut parser = Parser::with_depth(4);
+        let docs = [r#"{"a": [1, "x"]}"#, "[[[[]]]]", r#"{"b": true}"#];
+        for doc in docs {
+            assert!(parser.validate(doc.as_bytes()).is_ok());
+            let parsed = parser.parse(doc.as_bytes()).unwrap();
+            assert_eq!(parsed.root, analyse(doc.to_string()).unwrap().root);
+        }
+
+        // A failed document leaves nothing behind for the next one
+        assert!(parser.parse(br#"{"a": [1, "#).is_err());
+        assert!(parser.parse(br#"{"a": "unterminated"#).is_err());
+        assert!(parser.validate(b"[[[[[]]]]]").is_err());
+        let parsed = parser.parse(br#"{"c": null}"#).unwrap();
+        assert!(parsed.symbols.get("a").is_none());
+        assert_eq!(parsed.root.len(), 1);
+    }
+}
@@ -0,0 +1,268 @@
+use crate::error::Error;
+use crate::strings::{unescape, validate_utf8};
+use crate::{Builder, Document, Number, SymbolTable, Token, DEFAULT_MAX_DEPTH};
+
+#[derive(Debug, PartialEq)]
+pub enum Progress {
+    /// The document isn't complete yet, feed the next chunk.
+    NeedMore,
+    /// The top-level value is closed, only whitespaces may follow.
+    Done,
+}
+
+/// Token being read when a chunk ended.
+#[derive(Debug, Clone, Copy)]
+enum Lexeme {
+    None,
+    Str,
+    StrEscape,
+    Number,
+    Word(&'static [u8], usize),
+}
+
+/// Incremental parser for input received in chunks, like a network body.
+///
+/// The lexer keeps its state between two calls to `feed`, so a chunk may
+/// end anywhere, even in the middle of a string or a number. The bytes of
+/// the token being read are the only thing buffered.
+#[derive(Debug)]
+pub struct PushParser {
+    builder: Builder,
+    symbols: SymbolTable,
+    lexeme: Lexeme,
+    buf: Vec<u8>,
+    offset: usize,
+    started: bool,
+}
+
+impl Default for PushParser {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl PushParser {
+    pub fn new() -> Self {
+        Self::with_depth(DEFAULT_MAX_DEPTH)
+    }
+
+    pub fn with_depth(max_depth: usize) -> Self {
+        PushParser {
+            builder: Builder::new(max_depth),
+            symbols: SymbolTable::new(),
+            lexeme: Lexeme::None,
+            buf: Vec::new(),
+            offset: 0,
+            started: false,
+        }
+    }
+
+    pub fn feed(&mut self, chunk: &[u8]) -> Result<Progress, Error> {
+        let mut i = 0;
+        while i < chunk.len() {
+            let b = chunk[i];
+            match self.lexeme {
+                Lexeme::Str => {
+                    // Copy everything up to the next quote or escape at once
+                    let end = chunk[i..]
+                        .iter()
+                        .position(|b| *b == b'"' || *b == b'\\' || *b < 0x20);
+                    let end = end.map_or(chunk.len(), |j| i + j);
+                    self.buf.extend_from_slice(&chunk[i..end]);
+                    i = end;
+                    match chunk.get(i) {
+                        Some(b'"') => {
+                            self.lexeme = Lexeme::None;
+                            let raw = validate_utf8(&self.buf).map_err(|_| Error::InvalidUtf8)?;
+                            let l = unescape(raw)?.into_owned();
+                            self.buf.clear();
+                            self.emit(Token::Litteral(l))?;
+                        }
+                        Some(b'\\') => {
+                            self.buf.push(b'\\');
+                            self.lexeme = Lexeme::StrEscape;
+                        }
+                        Some(b'\n') => return Err(Error::LineBreakInLitteral),
+                        Some(&c) => return Err(Error::ControlCharInLitteral(c as char)),
+                        None => break,
+                    }
+                }
+                Lexeme::StrEscape => {
+                    self.buf.push(b);
+                    self.lexeme = Lexeme::Str;
+                }
+                Lexeme::Number => {
+                    if b"0123456789Ee.+-".contains(&b) {
+                        self.buf.push(b);
+                    } else {
+                        self.end_number()?;
+                        // This byte starts the next token
+                        continue;
+                    }
+                }
+                Lexeme::Word(word, n) => {
+                    if b != word[n] {
+                        return Err(Error::UnrecognizedToken(b as char, self.offset + i));
+                    }
+                    if n + 1 < word.len() {
+                        self.lexeme = Lexeme::Word(word, n + 1);
+                    } else {
+                        self.lexeme = Lexeme::None;
+                        self.emit(match word[0] {
+                            b't' => Token::True,
+                            b'f' => Token::False,
+                            _ => Token::Null,
+                        })?;
+                    }
+                }
+                Lexeme::None => match b {
+                    b'{' => self.emit(Token::OpenBracket)?,
+                    b'}' => self.emit(Token::CloseBracket)?,
+                    b'[' => self.emit(Token::OpenList)?,
+                    b']' => self.emit(Token::CloseList)?,
+                    b',' => self.emit(Token::Comma)?,
+                    b':' => self.emit(Token::Colon)?,
+                    b'"' => self.lexeme = Lexeme::Str,
+                    b't' => self.lexeme = Lexeme::Word(b"true", 1),
+                    b'f' => self.lexeme = Lexeme::Word(b"false", 1),
+                    b'n' => self.lexeme = Lexeme::Word(b"null", 1),
+                    b' ' | b'\n' | b'\r' | b'\t' => (),
+                    b'-' | b'0'..=b'9' => {
+                        self.buf.push(b);
+                        self.lexeme = Lexeme::Number;
+                    }
+                    _ => return Err(Error::UnrecognizedToken(b as char, self.offset + i)),
+                },
+            }
+            i += 1;
+        }
+        self.offset += chunk.len();
+
+        Ok(if self.builder.is_complete() {
+            Progress::Done
+        } else {
+            Progress::NeedMore
+        })
+    }
+
+    /// Ends the input and returns the document.
+    pub fn finish(mut self) -> Result<Document, Error> {
+        self.take_document()
+    }
+
+    /// Forgets the current document, keeping the buffers allocated.
+    pub(crate) fn reset(&mut self) {
+        self.builder.reset();
+        self.symbols = SymbolTable::new();
+        self.lexeme = Lexeme::None;
+        self.buf.clear();
+        self.offset = 0;
+        self.started = false;
+    }
+
+    /// Same as `finish`, leaving the parser ready for `reset`.
+    pub(crate) fn take_document(&mut self) -> Result<Document, Error> {
+        match self.lexeme {
+            Lexeme::None => (),
+            Lexeme::Number => self.end_number()?,
+            Lexeme::Str | Lexeme::StrEscape => return Err(Error::MismatchQuote),
+            Lexeme::Word(..) => return Err(Error::ParsingError),
+        }
+        if !self.started {
+            return Err(Error::MustBeginWithBracket);
+        }
+        let value = self.builder.take()?;
+        Ok(Document::from_value(
+            std::mem::take(&mut self.symbols),
+            value,
+        ))
+    }
+
+    fn end_number(&mut self) -> Result<(), Error> {
+        self.lexeme = Lexeme::None;
+        let n = std::str::from_utf8(&self.buf)
+            .map_err(|_| Error::InvalidNumber)
+            .and_then(Number::parse)?;
+        self.buf.clear();
+        self.emit(Token::Number(n))
+    }
+
+    fn emit(&mut self, token: Token) -> Result<(), Error> {
+        if !self.started {
+            if !matches!(token, Token::OpenBracket | Token::OpenList) {
+                return Err(Error::MustBeginWithBracket);
+            }
+            self.started = true;
+        }
+        self.builder.push(token, &mut self.symbols)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Progress, PushParser};
+    use crate::analyse;
+
+    #[test]
+    fn test_push_any_chunk_size() {
+        let input = std::fs::read_to_string("tests/step5/pass1.json").unwrap();
+        let expected = analyse(input.clone()).unwrap();
+
+        for size in 1..=17 {
+            let mut parser = PushParser::new();
+            let mut progress = Progress::NeedMore;
+            for chunk in input.as_bytes().chunks(size) {
+                progress = parser.feed(chunk).unwrap();
+            }
+            assert_eq!(progress, Progress::Done);
+            assert_eq!(
+                parser.finish().unwrap().root,
+                expected.root,
+                "chunks of {size}"
+            );
+        }
+    }
+
+    #[test]
+    fn test_push_split_utf8() {
+        let input = "[\"日本\", 12.5e1]".as_bytes();
+        let mut parser = PushParser::new();
+        parser.feed(&input[..4]).unwrap();
+        parser.feed(&input[4..12]).unwrap();
+        parser.feed(&input[12..]).unwrap();
+        let json = parser.finish().unwrap();
+        assert_eq!(
+            json.root,
+            analyse("[\"日本\", 12.5e1]".to_string()).unwrap().root
+        );
+    }
+
+    #[test]
+    fn test_push_steps() {
+        for step in 1..=5 {
+            for entry in std::fs::read_dir(format!("tests/step{step}/")).unwrap() {
+                let path = entry.unwrap().path();
+                let input = std::fs::read(&path).unwrap();
+                let mut parser = PushParser::new();
+                let pushed = input
+                    .chunks(3)
+                    .try_for_each(|c| parser.feed(c).map(|_| ()))
+                    .and_then(|_| parser.finish());
+                let analysed = analyse(String::from_utf8(input).unwrap());
+                assert_eq!(
+                    pushed.is_ok(),
+                    analysed.is_ok(),
+                    "Failed on file {:?}",
+                    path
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn test_push_extra_value() {
+        let mut parser = PushParser::new();
+        assert_eq!(parser.feed(b"{} \n").unwrap(), Progress::Done);
+        assert!(parser.feed(b"[]").is_err());
+    }
+}
@@ -0,0 +1,457 @@
+use std::borrow::Cow;
+use std::collections::BTreeMap;
+use std::io::{Read, Write};
+use std::sync::mpsc::{channel, sync_channel};
+use std::sync::{Arc, Mutex};
+use std::thread;
+
+use crate::error::{Error, Position};
+use crate::strings::validate_utf8;
+use crate::Cursor;
+
+/// Records are handed to the workers by blocks of about this size.
+const BLOCK_LEN: usize = 1024 * 1024;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Format {
+    /// Tab separated fields, strings decoded, missing fields and null empty.
+    Tsv,
+    /// One object per record, keyed by the selected paths.
+    Ndjson,
+}
+
+#[derive(Debug, PartialEq)]
+enum Scalar<'a> {
+    Null,
+    Bool(bool),
+    Number(f64),
+    Str(Cow<'a, str>),
+}
+
+#[derive(Debug)]
+struct Filter {
+    slot: usize,
+    equal: bool,
+    value: Scalar<'static>,
+}
+
+/// Tree of the paths a query reads, so each record is walked only once.
+#[derive(Debug, Default)]
+struct PathTree {
+    children: Vec<(String, PathTree)>,
+    slots: Vec<usize>, // Outputs (then the filter) reading this value
+}
+
+/// Fields to extract from NDJSON records, and the condition they must meet.
+///
+/// Records are only walked along the selected paths: other values are
+/// skipped by matching their quotes and brackets, without being decoded.
+#[derive(Debug)]
+pub struct Query {
+    paths: Vec<String>,
+    tree: PathTree,
+    filter: Option<Filter>,
+    format: Format,
+}
+
+impl PathTree {
+    fn insert(&mut self, path: &str, slot: usize) -> Result<(), Error> {
+        let mut node = self;
+        for key in path.split('.') {
+            if key.is_empty() {
+                return Err(Error::InvalidQuery(path.to_string()));
+            }
+            let i = match node.children.iter().position(|(k, _)| k == key) {
+                Some(i) => i,
+                None => {
+                    node.children.push((key.to_string(), PathTree::default()));
+                    node.children.len() - 1
+                }
+            };
+            node = &mut node.children[i].1;
+        }
+        node.slots.push(slot);
+        Ok(())
+    }
+
+    /// Stores the text of the values under this tree in `found`.
+    fn walk<'a>(
+        &self,
+        cursor: &mut Cursor<'a>,
+        found: &mut [Option<&'a str>],
+    ) -> Result<(), Error> {
+        if cursor.peek() != Some(b'{') {
+            return cursor.skip_value();
+        }
+        cursor.begin_object()?;
+        while let Some(key) = cursor.next_key()? {
+            match self.children.iter().find(|(k, _)| *k == *key) {
+                Some((_, child)) if child.slots.is_empty() => child.walk(cursor, found)?,
+                Some((_, child)) => {
+                    let raw = cursor.raw_value()?;
+                    child.slots.iter().for_each(|slot| found[*slot] = Some(raw));
+                    if !child.children.is_empty() {
+                        child.walk(&mut Cursor::new(raw), found)?;
+                    }
+                }
+                None => cursor.skip_value()?,
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Reads a scalar, None for arrays and objects.
+fn scalar(raw: &str) -> Result<Option<Scalar<'_>>, Error> {
+    let mut cursor = Cursor::new(raw);
+    let value = match cursor.peek() {
+        Some(b'"') => Scalar::Str(cursor.str()?),
+        Some(b't' | b'f') => Scalar::Bool(cursor.bool()?),
+        Some(b'n') => {
+            cursor.null()?;
+            Scalar::Null
+        }
+        Some(b'{' | b'[') => return Ok(None),
+        _ => Scalar::Number(cursor.number()?.parse().map_err(|_| Error::InvalidNumber)?),
+    };
+    cursor.finish()?;
+    Ok(Some(value))
+}
+
+/// Writes `text` with the tabs, line breaks and backslashes escaped.
+fn write_tsv_field(out: &mut Vec<u8>, text: &str) {
+    for b in text.bytes() {
+        match b {
+            b'\t' => out.extend_from_slice(b"\\t"),
+            b'\n' => out.extend_from_slice(b"\\n"),
+            b'\r' => out.extend_from_slice(b"\\r"),
+            b'\\' => out.extend_from_slice(b"\\\\"),
+            _ => out.push(b),
+        }
+    }
+}
+
+impl Query {
+    /// Builds a query from comma separated dotted paths, and a condition
+    /// like `a.b=="x"` or `c!=3` where the value is a json scalar.
+    pub fn new(select: &str, filter: Option<&str>, format: Format) -> Result<Self, Error> {
+        let paths: Vec<String> = select.split(',').map(str::to_string).collect();
+        let mut tree = PathTree::default();
+        for (slot, path) in paths.iter().enumerate() {
+            tree.insert(path, slot)?;
+        }
+
+        let filter = match filter {
+            None => None,
+            Some(filter) => {
+                let invalid = || Error::InvalidQuery(filter.to_string());
+                let (at, equal) = match (filter.find("=="), filter.find("!=")) {
+                    (Some(i), _) => (i, true),
+                    (None, Some(i)) => (i, false),
+                    (None, None) => return Err(invalid()),
+                };
+                let value = match scalar(&filter[at + 2..]) {
+                    Ok(Some(Scalar::Str(s))) => Scalar::Str(Cow::Owned(s.into_owned())),
+                    Ok(Some(Scalar::Null)) => Scalar::Null,
+                    Ok(Some(Scalar::Bool(b))) => Scalar::Bool(b),
+                    Ok(Some(Scalar::Number(n))) => Scalar::Number(n),
+                    _ => return Err(invalid()),
+                };
+                tree.insert(filter[..at].trim(), paths.len())?;
+                Some(Filter {
+                    slot: paths.len(),
+                    equal,
+                    value,
+                })
+            }
+        };
+
+        Ok(Query {
+            paths,
+            tree,
+            filter,
+            format,
+        })
+    }
+
+    fn slots(&self) -> usize {
+        self.paths.len() + self.filter.is_some() as usize
+    }
+
+    /// Writes the fields of the record on `line` if it meets the filter.
+    fn select_record<'a>(
+        &self,
+        line: &'a str,
+        found: &mut Vec<Option<&'a str>>,
+        out: &mut Vec<u8>,
+    ) -> Result<(), (usize, Error)> {
+        let mut cursor = Cursor::new(line);
+        found.clear();
+        found.resize(self.slots(), None);
+        self.tree
+            .walk(&mut cursor, found)
+            .and_then(|_| cursor.finish())
+            .map_err(|e| (cursor.pos(), e))?;
+        // Found values were only skipped, decoding them may still fail
+        let decode = |raw: &'a str| {
+            scalar(raw).map_err(|e| (raw.as_ptr() as usize - line.as_ptr() as usize, e))
+        };
+
+        if let Some(filter) = &self.filter {
+            let value = match found[filter.slot] {
+                Some(raw) => decode(raw)?,
+                None => None,
+            };
+            if (value.as_ref() == Some(&filter.value)) != filter.equal {
+                return Ok(());
+            }
+        }
+
+        let fields = &found[..self.paths.len()];
+        match self.format {
+            Format::Tsv => {
+                for (i, field) in fields.iter().enumerate() {
+                    if i > 0 {
+                        out.push(b'\t');
+                    }
+                    if let Some(raw) = field {
+                        match decode(raw)? {
+                            Some(Scalar::Str(s)) => write_tsv_field(out, &s),
+                            Some(Scalar::Null) => (),
+                            _ => write_tsv_field(out, raw),
+                        }
+                    }
+                }
+            }
+            Format::Ndjson => {
+                out.push(b'{');
+                for (i, (path, field)) in self.paths.iter().zip(fields).enumerate() {
+                    if i > 0 {
+                        out.push(b',');
+                    }
+                    out.push(b'"');
+                    for b in path.bytes() {
+                        if b == b'"' || b == b'\\' {
+                            out.push(b'\\');
+                        }
+                        out.push(b);
+                    }
+                    out.extend_from_slice(b"\":");
+                    out.extend_from_slice(field.unwrap_or("null").as_bytes());
+                }
+                out.push(b'}');
+            }
+        }
+        out.push(b'\n');
+        Ok(())
+    }
+
+    /// Runs the query on every line of `block`, returning how many there
+    /// are, or the offset and the error of the first invalid record.
+    fn select_block(&self, block: &[u8], out: &mut Vec<u8>) -> Result<usize, (usize, Error)> {
+        let text = validate_utf8(block).map_err(|e| match e {
+            Error::At(p, e) => (p.offset, *e),
+            e => (0, e),
+        })?;
+        let mut found = Vec::with_capacity(self.slots());
+        let mut lines = 0;
+        let mut start = 0;
+        for line in text.split_inclusive('\n') {
+            lines += 1;
+            if !line.trim().is_empty() {
+                self.select_record(line, &mut found, out)
+                    .map_err(|(offset, e)| (start + offset, e))?;
+            }
+            start += line.len();
+        }
+        Ok(lines)
+    }
+}
+
+/// Reads the records of `input` by blocks and runs `query` on them with
+/// `threads` workers, writing the results to `output` in record order.
+///
+/// Memory stays bounded whatever the size of the input: the reader waits
+/// while all the workers are busy and their queue is full.
+pub fn select(
+    mut input: impl Read + Send,
+    output: &mut impl Write,
+    query: &Query,
+    threads: usize,
+) -> Result<(), Error> {
+    let threads = threads.max(1);
+    let (block_tx, block_rx) = sync_channel::<(usize, Vec<u8>)>(threads * 2);
+    let (done_tx, done_rx) = channel();
+
+    thread::scope(|s| {
+        let reader = s.spawn(move || {
+            read_blocks(&mut input, |seq, block| block_tx.send((seq, block)).is_ok())
+        });
+
+        // Only the workers hold the receiver: once they stop, on an error,
+        // the reader can't block on a full queue and stops too
+        let block_rx = Arc::new(Mutex::new(block_rx));
+        for _ in 0..threads {
+            let (block_rx, done_tx) = (Arc::clone(&block_rx), done_tx.clone());
+            s.spawn(move || loop {
+                let (seq, block) = match block_rx.lock().unwrap().recv() {
+                    Ok(job) => job,
+                    Err(_) => break,
+                };
+                let mut out = Vec::with_capacity(block.len() / 4);
+                let result = query.select_block(&block, &mut out);
+                let result = result
+                    .map(|lines| (lines, out))
+                    .map_err(|(offset, e)| (Position::locate(&block, offset), e));
+                if done_tx.send((seq, block.len(), result)).is_err() {
+                    break;
+                }
+            });
+        }
+        drop((block_rx, done_tx));
+
+        // Write the blocks back in order, keeping count of the lines and
+        // bytes before them to locate errors in the whole input
+        let mut pending = BTreeMap::new();
+        let (mut next, mut line, mut offset) = (0, 0, 0);
+        for (seq, len, result) in done_rx {
+            pending.insert(seq, (len, result));
+            while let Some((len, result)) = pending.remove(&next) {
+                match result {
+                    Ok((lines, out)) => {
+                        output.write_all(&out).map_err(|_| Error::FileWriting)?;
+                        line += lines;
+                        offset += len;
+                    }
+                    Err((p, e)) => {
+                        let p = Position {
+                            offset: offset + p.offset,
+                            line: line + p.line,
+                            column: p.column,
+                        };
+                        return Err(Error::At(p, Box::new(e)));
+                    }
+                }
+                next += 1;
+            }
+        }
+        output.flush().map_err(|_| Error::FileWriting)?;
+        reader.join().unwrap()
+    })
+}
+
+/// Cuts `input` into blocks of whole lines, stopping early if `send`
+/// returns false.
+fn read_blocks(
+    input: &mut impl Read,
+    mut send: impl FnMut(usize, Vec<u8>) -> bool,
+) -> Result<(), Error> {
+    let mut carry = Vec::new();
+    for seq in 0.. {
+        let mut block = std::mem::take(&mut carry);
+        block.reserve(BLOCK_LEN);
+        let mut eof = false;
+        // Read until the block holds a line break, or the input ends
+        loop {
+            let len = block.len();
+            block.resize(len + BLOCK_LEN.max(len / 2), 0);
+            let n = input
+                .read(&mut block[len..])
+                .map_err(|_| Error::FileUnreadable)?;
+            block.truncate(len + n);
+            if n == 0 {
+                eof = true;
+                break;
+            }
+            if block.len() >= BLOCK_LEN && block[len..].contains(&b'\n') {
+                break;
+            }
+        }
+
+        if !eof {
+            let cut = block
+                .iter()
+                .rposition(|b| *b == b'\n')
+                .map_or(block.len(), |i| i + 1);
+            carry = block.split_off(cut);
+        }
+        if !block.is_empty() && !send(seq, block) {
+            return Ok(());
+        }
+        if eof {
+            return Ok(());
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{select, Format, Query};
+
+    fn run(input: &str, select_: &str, filter: Option<&str>, format: Format) -> String {
+        let query = Query::new(select_, filter, format).unwrap();
+        let mut out = Vec::new();
+        select(input.as_bytes(), &mut out, &query, 3).unwrap();
+        String::from_utf8(out).unwrap()
+    }
+
+    const RECORDS: &str = r#"{"id": 1, "user": {"name": "a\tb", "tags": [1, 2]}, "d": "x"}
+{"id": 2, "user": {"name": "\u00e9"}, "d": "y", "skipped": {"d": "x"}}
+
+{"d": "x", "id": 3, "user": null}
+"#;
+
+    #[test]
+    fn test_select_tsv() {
+        let out = run(RECORDS, "id,user.name,user.tags", None, Format::Tsv);
+        assert_eq!(out, "1\ta\\tb\t[1, 2]\n2\té\t\n3\t\t\n");
+
+        let out = run(RECORDS, "user.name,id", Some(r#"d=="x""#), Format::Tsv);
+        assert_eq!(out, "a\\tb\t1\n\t3\n");
+
+        let out = run(RECORDS, "id", Some("id!=2"), Format::Tsv);
+        assert_eq!(out, "1\n3\n");
+    }
+
+    #[test]
+    fn test_select_ndjson() {
+        let out = run(RECORDS, "id,user.name", Some(r#"d!="x""#), Format::Ndjson);
+        assert_eq!(out, "{\"id\":2,\"user.name\":\"\\u00e9\"}\n");
+    }
+
+    #[test]
+    fn test_select_many_blocks() {
+        let input: String = (0..200_000)
+            .map(|i| format!("{{\"id\": {i}, \"pad\": \"{}\"}}\n", "x".repeat(i % 50)))
+            .collect();
+        let out = run(&input, "id", Some("pad==\"\""), Format::Tsv);
+        let expected: String = (0..200_000).step_by(50).map(|i| format!("{i}\n")).collect();
+        assert_eq!(out, expected);
+    }
+
+    #[test]
+    fn test_select_errors() {
+        assert!(Query::new("a..b", None, Format::Tsv).is_err());
+        assert!(Query::new("a", Some("b=x"), Format::Tsv).is_err());
+        assert!(Query::new("a", Some("b==[1]"), Format::Tsv).is_err());
+
+        let query = Query::new("id", None, Format::Tsv).unwrap();
+        let input = "{\"id\": 1}\n{\"id\": 2,}\n";
+        let err = select(input.as_bytes(), &mut Vec::new(), &query, 2).unwrap_err();
+        assert!(matches!(err, crate::Error::At(p, _) if p.line == 2));
+
+        // Fields nobody selected are still checked
+        let input = "{\"id\": 1, \"x\": [@#$]}\n";
+        let err = select(input.as_bytes(), &mut Vec::new(), &query, 2).unwrap_err();
+        assert!(matches!(err, crate::Error::At(p, _) if p.column == 17));
+
+        // An error in the first block of a large input stops the reader
+        let input = format!(
+            "{{\"id\": 1}}\n{{\"id\": }}\n{}",
+            "{\"id\": 2}\n".repeat(4_000_000)
+        );
+        let err = select(input.as_bytes(), &mut Vec::new(), &query, 2).unwrap_err();
+        assert!(matches!(err, crate::Error::At(p, _) if p.line == 2));
+    }
+}
@@ -0,0 +1,423 @@
+use crate::error::Error;
+use crate::{Document, Value, KV};
+
+const MAGIC: &[u8; 4] = b"JBIN";
+const VERSION: u32 = 3;
+const HEADER_LEN: usize = 32;
+const NODE_LEN: usize = 16;
+const SYMBOL_LEN: usize = 16;
+
+const NULL: u8 = 0;
+const FALSE: u8 = 1;
+const TRUE: u8 = 2;
+const NUMBER: u8 = 3;
+const STR: u8 = 4;
+const ARRAY: u8 = 5;
+const OBJECT: u8 = 6;
+const KEY: u8 = 7;
+
+/// Writes `doc` in the snapshot format read by `Snapshot`.
+///
+/// Everything is little endian, and offsets are relative to the start of
+/// the file so it can be mapped anywhere:
+///
+/// - header, 32 bytes : magic "JBIN", version (u32), number of nodes (u64),
+///   number of symbols (u64), length of the string arena (u64)
+/// - nodes, 16 bytes each : tag (u8), 3 bytes of padding, a (u32), b (u64)
+///     - number, str : a is the length of the text, b its offset in the
+///       arena. Numbers keep the text they were written with
+///     - array, object : a is the number of items, b the index of the node
+///       following the container, its items come right after it. Object
+///       items are a key node (a is its symbol) followed by the value
+/// - symbols, 16 bytes each : offset in the arena (u64), length (u64)
+/// - the arena holding all the keys, strings and numbers
+///
+/// The first node is the root of the document, an array or an object.
+/// Strings, arrays and objects longer than `u32::MAX` can't be written.
+pub fn compile(doc: &Document) -> Result<Vec<u8>, Error> {
+    let mut nodes = Vec::new();
+    let mut symbols = Vec::new();
+    let mut arena = Vec::new();
+
+    for (_, key) in doc.symbols.iter() {
+        symbols.extend((arena.len() as u64).to_le_bytes());
+        symbols.extend((key.len() as u64).to_le_bytes());
+        arena.extend_from_slice(key.as_bytes());
+    }
+    match doc.is_array {
+        true => write_value(&doc.root[0].1, &mut nodes, &mut arena)?,
+        false => write_object(&doc.root, &mut nodes, &mut arena)?,
+    }
+
+    let mut out = Vec::with_capacity(HEADER_LEN + nodes.len() + symbols.len() + arena.len());
+    out.extend_from_slice(MAGIC);
+    out.extend(VERSION.to_le_bytes());
+    out.extend(((nodes.len() / NODE_LEN) as u64).to_le_bytes());
+    out.extend(((symbols.len() / SYMBOL_LEN) as u64).to_le_bytes());
+    out.extend((arena.len() as u64).to_le_bytes());
+    out.extend(nodes);
+    out.extend(symbols);
+    out.extend(arena);
+    Ok(out)
+}
+
+/// Length to store in the 32 bits of a node.
+fn len32(len: usize) -> Result<u32, Error> {
+    u32::try_from(len).map_err(|_| Error::SnapshotTooLarge)
+}
+
+fn push_node(nodes: &mut Vec<u8>, tag: u8, a: u32, b: u64) {
+    nodes.extend([tag, 0, 0, 0]);
+    nodes.extend(a.to_le_bytes());
+    nodes.extend(b.to_le_bytes());
+}
+
+/// Sets where the container at `index` ends, once its items are written.
+fn patch_end(nodes: &mut [u8], index: usize) {
+    let end = (nodes.len() / NODE_LEN) as u64;
+    nodes[index * NODE_LEN + 8..(index + 1) * NODE_LEN].copy_from_slice(&end.to_le_bytes());
+}
+
+fn write_object(kvs: &[KV], nodes: &mut Vec<u8>, arena: &mut Vec<u8>) -> Result<(), Error> {
+    let index = nodes.len() / NODE_LEN;
+    push_node(nodes, OBJECT, len32(kvs.len())?, 0);
+    for KV(key, value) in kvs {
+        push_node(nodes, KEY, key.id(), 0);
+        write_value(value, nodes, arena)?;
+    }
+    patch_end(nodes, index);
+    Ok(())
+}
+
+fn write_value(value: &Value, nodes: &mut Vec<u8>, arena: &mut Vec<u8>) -> Result<(), Error> {
+    match value {
+        Value::Null => push_node(nodes, NULL, 0, 0),
+        Value::Bool(false) => push_node(nodes, FALSE, 0, 0),
+        Value::Bool(true) => push_node(nodes, TRUE, 0, 0),
+        Value::Number(n) => {
+            push_node(nodes, NUMBER, len32(n.as_str().len())?, arena.len() as u64);
+            arena.extend_from_slice(n.as_str().as_bytes());
+        }
+        Value::Str(s) => {
+            push_node(nodes, STR, len32(s.len())?, arena.len() as u64);
+            arena.extend_from_slice(s.as_bytes());
+        }
+        Value::Array(values) => {
+            let index = nodes.len() / NODE_LEN;
+            push_node(nodes, ARRAY, len32(values.len())?, 0);
+            for v in values {
+                write_value(v, nodes, arena)?;
+            }
+            patch_end(nodes, index);
+        }
+        Value::Object(kvs) => write_object(kvs, nodes, arena)?,
+    }
+    Ok(())
+}
+
+/// Read-only view of a compiled document, straight from its bytes.
+///
+/// Nothing is parsed nor copied when opening it, only the header is
+/// checked, so it can sit on top of a memory mapped file. A corrupted body
+/// may make the accessors panic but never read out of `bytes`.
+#[derive(Debug, Clone, Copy)]
+pub struct Snapshot<'a> {
+    nodes: &'a [u8],
+    symbols: &'a [u8],
+    arena: &'a [u8],
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Kind {
+    Null,
+    Bool,
+    Number,
+    Str,
+    Array,
+    Object,
+}
+
+/// A value of a `Snapshot`.
+#[derive(Debug, Clone, Copy)]
+pub struct Node<'a> {
+    snapshot: Snapshot<'a>,
+    index: usize,
+}
+
+fn u64_at(bytes: &[u8], at: usize) -> u64 {
+    u64::from_le_bytes(bytes[at..at + 8].try_into().unwrap())
+}
+
+impl<'a> Snapshot<'a> {
+    pub fn new(bytes: &'a [u8]) -> Result<Self, Error> {
+        if bytes.len() < HEADER_LEN || &bytes[..4] != MAGIC {
+            return Err(Error::InvalidSnapshot);
+        }
+        if u32::from_le_bytes(bytes[4..8].try_into().unwrap()) != VERSION {
+            return Err(Error::InvalidSnapshot);
+        }
+
+        let count = |at, len: usize| {
+            (u64_at(bytes, at) as usize)
+                .checked_mul(len)
+                .ok_or(Error::InvalidSnapshot)
+        };
+        let (nodes, symbols, arena) = (count(8, NODE_LEN)?, count(16, SYMBOL_LEN)?, count(24, 1)?);
+        let total = [nodes, symbols, arena]
+            .iter()
+            .try_fold(HEADER_LEN, |acc, n| acc.checked_add(*n));
+        if nodes == 0 || total != Some(bytes.len()) {
+            return Err(Error::InvalidSnapshot);
+        }
+
+        let (nodes, rest) = bytes[HEADER_LEN..].split_at(nodes);
+        let (symbols, arena) = rest.split_at(symbols);
+        Ok(Snapshot {
+            nodes,
+            symbols,
+            arena,
+        })
+    }
+
+    pub fn root(&self) -> Node<'a> {
+        Node {
+            snapshot: *self,
+            index: 0,
+        }
+    }
+
+    /// Number of nodes, object keys included.
+    pub(crate) fn node_count(&self) -> usize {
+        self.nodes.len() / NODE_LEN
+    }
+
+    pub(crate) fn node(&self, index: usize) -> Node<'a> {
+        Node {
+            snapshot: *self,
+            index,
+        }
+    }
+
+    pub fn symbol(&self, id: u32) -> &'a str {
+        let at = id as usize * SYMBOL_LEN;
+        let offset = u64_at(self.symbols, at) as usize;
+        let len = u64_at(self.symbols, at + 8) as usize;
+        std::str::from_utf8(&self.arena[offset..offset + len]).unwrap_or_default()
+    }
+}
+
+impl<'a> Node<'a> {
+    fn tag(&self) -> u8 {
+        self.snapshot.nodes[self.index * NODE_LEN]
+    }
+
+    fn a(&self) -> u32 {
+        let at = self.index * NODE_LEN + 4;
+        u32::from_le_bytes(self.snapshot.nodes[at..at + 4].try_into().unwrap())
+    }
+
+    fn b(&self) -> u64 {
+        u64_at(self.snapshot.nodes, self.index * NODE_LEN + 8)
+    }
+
+    fn at(&self, index: usize) -> Node<'a> {
+        Node {
+            snapshot: self.snapshot,
+            index,
+        }
+    }
+
+    /// Index of the node following this one and its items.
+    fn next(&self) -> usize {
+        match self.tag() {
+            ARRAY | OBJECT => self.b() as usize,
+            _ => self.index + 1,
+        }
+    }
+
+    /// Position of the node in the snapshot.
+    pub(crate) fn id(&self) -> usize {
+        self.index
+    }
+
+    pub(crate) fn is_key(&self) -> bool {
+        self.tag() == KEY
+    }
+
+    pub fn kind(&self) -> Kind {
+        match self.tag() {
+            NULL => Kind::Null,
+            FALSE | TRUE => Kind::Bool,
+            NUMBER => Kind::Number,
+            STR => Kind::Str,
+            ARRAY => Kind::Array,
+            _ => Kind::Object,
+        }
+    }
+
+    pub fn as_bool(&self) -> Option<bool> {
+        match self.tag() {
+            FALSE => Some(false),
+            TRUE => Some(true),
+            _ => None,
+        }
+    }
+
+    /// Nearest `f64` of a number.
+    pub fn as_f64(&self) -> Option<f64> {
+        self.as_number()?.parse().ok()
+    }
+
+    /// A number as written in the document, whatever its precision.
+    pub fn as_number(&self) -> Option<&'a str> {
+        (self.tag() == NUMBER).then(|| self.text())?
+    }
+
+    pub fn as_str(&self) -> Option<&'a str> {
+        (self.tag() == STR).then(|| self.text())?
+    }
+
+    fn text(&self) -> Option<&'a str> {
+        let offset = self.b() as usize;
+        std::str::from_utf8(&self.snapshot.arena[offset..offset + self.a() as usize]).ok()
+    }
+
+    /// Number of items of an array or object, 0 for the other kinds.
+    pub fn len(&self) -> usize {
+        match self.tag() {
+            ARRAY | OBJECT => self.a() as usize,
+            _ => 0,
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Values of an array, empty for the other kinds.
+    pub fn items(&self) -> impl Iterator<Item = Node<'a>> {
+        let len = if self.tag() == ARRAY { self.len() } else { 0 };
+        let mut next = self.index + 1;
+        let node = *self;
+        (0..len).map(move |_| {
+            let item = node.at(next);
+            next = item.next();
+            item
+        })
+    }
+
+    /// Members of an object, empty for the other kinds.
+    pub fn entries(&self) -> impl Iterator<Item = (&'a str, Node<'a>)> {
+        let len = if self.tag() == OBJECT { self.len() } else { 0 };
+        let mut next = self.index + 1;
+        let node = *self;
+        (0..len).map(move |_| {
+            let key = node.snapshot.symbol(node.at(next).a());
+            let value = node.at(next + 1);
+            next = value.next();
+            (key, value)
+        })
+    }
+
+    pub fn get(&self, key: &str) -> Option<Node<'a>> {
+        self.entries().find(|(k, _)| *k == key).map(|(_, v)| v)
+    }
+
+    pub fn index(&self, i: usize) -> Option<Node<'a>> {
+        self.items().nth(i)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{compile, len32, Kind, Node, Snapshot};
+    use crate::{analyse, Document, Value, KV};
+
+    fn assert_same_object(doc: &Document, kvs: &[KV], node: Node) {
+        assert_eq!(node.kind(), Kind::Object);
+        assert_eq!(node.len(), kvs.len());
+        for (kv, (k, n)) in kvs.iter().zip(node.entries()) {
+            assert_eq!(doc.key(kv), k);
+            assert_same(doc, &kv.1, n);
+        }
+    }
+
+    fn assert_same(doc: &Document, value: &Value, node: Node) {
+        match value {
+            Value::Null => assert_eq!(node.kind(), Kind::Null),
+            Value::Bool(b) => assert_eq!(node.as_bool(), Some(*b)),
+            Value::Number(n) => assert_eq!(node.as_number(), Some(n.as_str())),
+            Value::Str(s) => assert_eq!(node.as_str(), Some(s.as_str())),
+            Value::Array(values) => {
+                assert_eq!(node.len(), values.len());
+                for (v, n) in values.iter().zip(node.items()) {
+                    assert_same(doc, v, n);
+                }
+            }
+            Value::Object(kvs) => assert_same_object(doc, kvs, node),
+        }
+    }
+
+    #[test]
+    fn test_snapshot_round_trip() {
+        let doc = analyse(std::fs::read_to_string("tests/step5/pass1.json").unwrap()).unwrap();
+        let bytes = compile(&doc).unwrap();
+        let snapshot = Snapshot::new(&bytes).unwrap();
+        assert_same(&doc, &doc.root[0].1, snapshot.root());
+
+        let json = snapshot.root();
+        assert_eq!(
+            json.index(0).unwrap().as_str(),
+            Some("JSON Test Pattern pass1")
+        );
+        let object = json.index(8).unwrap();
+        assert_eq!(object.get("integer").unwrap().as_f64(), Some(1234567890.0));
+        assert_eq!(object.get("compact").unwrap().len(), 7);
+        assert!(object.get("missing").is_none());
+    }
+
+    #[test]
+    fn test_snapshot_numbers() {
+        // Beyond what an f64 holds, or outside its range
+        let numbers = [
+            "12345678901234567891",
+            "0.1000000000000000000001",
+            "1e400",
+            "-0",
+        ];
+        let doc = analyse(format!("[{}]", numbers.join(","))).unwrap();
+        let bytes = compile(&doc).unwrap();
+        let snapshot = Snapshot::new(&bytes).unwrap();
+        let items = snapshot.root();
+        let read: Vec<_> = items.items().map(|n| n.as_number().unwrap()).collect();
+        assert_eq!(read, numbers);
+        assert_eq!(items.index(2).unwrap().as_f64(), Some(f64::INFINITY));
+        assert_eq!(items.index(0).unwrap().as_str(), None);
+    }
+
+    #[test]
+    fn test_snapshot_root() {
+        let array = compile(&analyse("[1]".to_string()).unwrap()).unwrap();
+        let object = compile(&analyse(r#"{"": [1]}"#.to_string()).unwrap()).unwrap();
+        assert_ne!(array, object);
+
+        let array = Snapshot::new(&array).unwrap().root();
+        assert_eq!(array.kind(), Kind::Array);
+        assert_eq!(array.index(0).unwrap().as_number(), Some("1"));
+        let object = Snapshot::new(&object).unwrap().root();
+        assert_eq!(object.kind(), Kind::Object);
+        assert_eq!(object.get("").unwrap().kind(), Kind::Array);
+    }
+
+    #[test]
+    fn test_snapshot_invalid() {
+        let doc = analyse(r#"{"a": [1, 2]}"#.to_string()).unwrap();
+        let bytes = compile(&doc).unwrap();
+        assert!(Snapshot::new(&bytes).is_ok());
+        assert!(Snapshot::new(&bytes[..bytes.len() - 1]).is_err());
+        assert!(Snapshot::new(b"JSON").is_err());
+
+        assert_eq!(len32(u32::MAX as usize).ok(), Some(u32::MAX));
+        assert!(len32(u32::MAX as usize + 1).is_err());
+    }
+}
@@ -0,0 +1,299 @@
+use std::borrow::Cow;
+
+use crate::error::{Error, Position};
+
+/// Checks that `bytes` is valid utf8 and returns it as a str.
+///
+/// On x86_64 with SSSE3, 16 bytes blocks are checked at once with the
+/// lookup algorithm of Keiser & Lemire ("Validating UTF-8 in less than one
+/// instruction per byte"), pure ascii blocks being skipped right away.
+/// Elsewhere it falls back on the standard library.
+pub fn validate_utf8(bytes: &[u8]) -> Result<&str, Error> {
+    match utf8_error(bytes) {
+        // SAFETY: every byte of the input has just been validated
+        None => Ok(unsafe { std::str::from_utf8_unchecked(bytes) }),
+        Some(offset) => Err(Error::At(
+            Position::locate(bytes, offset),
+            Box::new(Error::InvalidUtf8),
+        )),
+    }
+}
+
+/// Returns the offset of the first invalid sequence, if any.
+fn utf8_error(bytes: &[u8]) -> Option<usize> {
+    #[cfg(target_arch = "x86_64")]
+    if is_x86_feature_detected!("ssse3") {
+        // SAFETY: the cpu supports the instructions enabled for this function
+        let checked = unsafe { simd::valid_prefix(bytes) };
+        return std::str::from_utf8(&bytes[checked..])
+            .err()
+            .map(|e| checked + e.valid_up_to());
+    }
+    std::str::from_utf8(bytes).err().map(|e| e.valid_up_to())
+}
+
+#[cfg(target_arch = "x86_64")]
+mod simd {
+    use std::arch::x86_64::*;
+
+    const TOO_SHORT: i8 = 1 << 0;
+    const TOO_LONG: i8 = 1 << 1;
+    const OVERLONG_3: i8 = 1 << 2;
+    const TOO_LARGE: i8 = 1 << 3;
+    const SURROGATE: i8 = 1 << 4;
+    const OVERLONG_2: i8 = 1 << 5;
+    const TOO_LARGE_1000: i8 = 1 << 6;
+    const OVERLONG_4: i8 = 1 << 6;
+    const TWO_CONTS: i8 = 1 << 7;
+    const CARRY: i8 = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    #[target_feature(enable = "ssse3")]
+    unsafe fn lookup(table: [i8; 16], index: __m128i) -> __m128i {
+        let table = _mm_loadu_si128(table.as_ptr() as *const __m128i);
+        _mm_shuffle_epi8(table, index)
+    }
+
+    #[target_feature(enable = "ssse3")]
+    unsafe fn high_nibbles(v: __m128i) -> __m128i {
+        _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F))
+    }
+
+    /// Flags the invalid bytes of `input`, knowing the block before it.
+    #[target_feature(enable = "ssse3")]
+    unsafe fn check_block(input: __m128i, prev: __m128i) -> __m128i {
+        let prev1 = _mm_alignr_epi8(input, prev, 15);
+        let byte_1_high = lookup(
+            [
+                TOO_LONG,
+                TOO_LONG,
+                TOO_LONG,
+                TOO_LONG,
+                TOO_LONG,
+                TOO_LONG,
+                TOO_LONG,
+                TOO_LONG,
+                TWO_CONTS,
+                TWO_CONTS,
+                TWO_CONTS,
+                TWO_CONTS,
+                TOO_SHORT | OVERLONG_2,
+                TOO_SHORT,
+                TOO_SHORT | OVERLONG_3 | SURROGATE,
+                TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+            ],
+            high_nibbles(prev1),
+        );
+        let large = CARRY | TOO_LARGE | TOO_LARGE_1000;
+        let byte_1_low = lookup(
+            [
+                CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                CARRY | OVERLONG_2,
+                CARRY,
+                CARRY,
+                CARRY | TOO_LARGE,
+                large,
+                large,
+                large,
+                large,
+                large,
+                large,
+                large,
+                large,
+                large | SURROGATE,
+                large,
+                large,
+            ],
+            _mm_and_si128(prev1, _mm_set1_epi8(0x0F)),
+        );
+        let cont = TOO_LONG | OVERLONG_2 | TWO_CONTS;
+        let byte_2_high = lookup(
+            [
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                cont | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                cont | OVERLONG_3 | TOO_LARGE,
+                cont | SURROGATE | TOO_LARGE,
+                cont | SURROGATE | TOO_LARGE,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+                TOO_SHORT,
+            ],
+            high_nibbles(input),
+        );
+        let special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+        // Third and fourth bytes of a sequence must be continuations
+        let prev2 = _mm_alignr_epi8(input, prev, 14);
+        let prev3 = _mm_alignr_epi8(input, prev, 13);
+        let third = _mm_subs_epu8(prev2, _mm_set1_epi8((0xE0u8 - 0x80) as i8));
+        let fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((0xF0u8 - 0x80) as i8));
+        let must_be_cont = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(0x80u8 as i8));
+        _mm_xor_si128(must_be_cont, special)
+    }
+
+    /// Validates whole blocks and returns the length of the prefix known to
+    /// be valid. It stops early on an error, and before a sequence that may
+    /// continue past the last block, for the caller to check the rest.
+    #[target_feature(enable = "ssse3")]
+    pub unsafe fn valid_prefix(bytes: &[u8]) -> usize {
+        let mut prev = _mm_setzero_si128();
+        let mut i = 0;
+        while i + 16 <= bytes.len() {
+            let input = _mm_loadu_si128(bytes.as_ptr().add(i) as *const __m128i);
+            // Pure ascii, and nothing left open by the previous block
+            let ascii = _mm_movemask_epi8(input) == 0 && _mm_movemask_epi8(prev) & 0xE000 == 0;
+            if !ascii {
+                let error = check_block(input, prev);
+                if _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF {
+                    break;
+                }
+            }
+            prev = input;
+            i += 16;
+        }
+
+        // Back up to the start of the last char, it may be incomplete
+        let start = i.saturating_sub(4);
+        match bytes[start..i].iter().rposition(|b| *b & 0xC0 != 0x80) {
+            Some(j) if bytes[start + j] >= 0xC0 => start + j,
+            Some(_) => i,
+            None => start,
+        }
+    }
+}
+
+/// Decodes the escape sequences of the content of a string, only
+/// allocating if there are some. Raw control chars must have been rejected
+/// by the lexer already.
+pub(crate) fn unescape(raw: &str) -> Result<Cow<'_, str>, Error> {
+    let first = match raw.find('\\') {
+        Some(i) => i,
+        None => return Ok(Cow::Borrowed(raw)),
+    };
+
+    let bytes = raw.as_bytes();
+    let mut out = String::with_capacity(raw.len());
+    out.push_str(&raw[..first]);
+    let mut i = first;
+    while i < bytes.len() {
+        // Copy the run of plain chars up to the next escape at once
+        let next = raw[i..].find('\\').map_or(raw.len(), |j| i + j);
+        out.push_str(&raw[i..next]);
+        i = next;
+        if i == raw.len() {
+            break;
+        }
+
+        let escaped = match bytes.get(i + 1) {
+            Some(b'"') => '"',
+            Some(b'\\') => '\\',
+            Some(b'/') => '/',
+            Some(b'b') => '\u{8}',
+            Some(b'f') => '\u{c}',
+            Some(b'n') => '\n',
+            Some(b'r') => '\r',
+            Some(b't') => '\t',
+            Some(b'u') => {
+                let (c, len) = unicode_escape(&bytes[i..])?;
+                out.push(c);
+                i += len;
+                continue;
+            }
+            Some(_) => {
+                let c = raw[i + 1..].chars().next().unwrap();
+                return Err(Error::InvalidEscape(c));
+            }
+            None => return Err(Error::MismatchQuote),
+        };
+        out.push(escaped);
+        i += 2;
+    }
+    Ok(Cow::Owned(out))
+}
+
+pub(crate) fn hex4(bytes: &[u8]) -> Option<u16> {
+    let hex = std::str::from_utf8(bytes.get(..4)?).ok()?;
+    if !hex.bytes().all(|b| b.is_ascii_hexdigit()) {
+        return None;
+    }
+    u16::from_str_radix(hex, 16).ok()
+}
+
+/// Decodes the `\uXXXX` escape at the start of `bytes`, or the surrogate
+/// pair `\uXXXX\uXXXX`, and returns the char and the length read.
+pub(crate) fn unicode_escape(bytes: &[u8]) -> Result<(char, usize), Error> {
+    let invalid = Error::InvalidEscape('u');
+    let high = hex4(&bytes[2..]).ok_or(Error::InvalidEscape('u'))?;
+    match high {
+        0xD800..=0xDBFF => {
+            if bytes.get(6..8) != Some(b"\\u") {
+                return Err(invalid);
+            }
+            match hex4(&bytes[8..]) {
+                Some(low @ 0xDC00..=0xDFFF) => {
+                    let c = 0x10000 + ((high as u32 - 0xD800) << 10) + (low as u32 - 0xDC00);
+                    Ok((char::from_u32(c).ok_or(invalid)?, 12))
+                }
+                _ => Err(invalid),
+            }
+        }
+        0xDC00..=0xDFFF => Err(invalid),
+        _ => Ok((char::from_u32(high as u32).ok_or(invalid)?, 6)),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{unescape, utf8_error};
+
+    #[test]
+    fn test_utf8_same_as_std() {
+        let samples: Vec<Vec<u8>> = vec![
+            "plain ascii text that spans more than one block".into(),
+            "中文字符和日本語のテキスト, mixed with ascii 😀 and é".into(),
+            vec![0xC0, 0x80],             // overlong
+            vec![0xE0, 0x80, 0x80],       // overlong
+            vec![0xED, 0xA0, 0x80],       // surrogate
+            vec![0xF4, 0x90, 0x80, 0x80], // too large
+            vec![0xF0, 0x9F, 0x98],       // truncated
+            vec![0x80],                   // lone continuation
+            vec![0xE4, 0xB8, 0x41],       // too short
+            vec![0xFF],
+        ];
+
+        for sample in samples {
+            // Move the sample around the block boundaries
+            for pad in 0..20 {
+                for tail in [0, 1, 2, 17] {
+                    let mut input = "a".repeat(pad).into_bytes();
+                    input.extend(&sample);
+                    input.extend("中".repeat(tail).bytes());
+                    assert_eq!(
+                        utf8_error(&input),
+                        std::str::from_utf8(&input).err().map(|e| e.valid_up_to()),
+                        "{input:?}"
+                    );
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_unescape() {
+        assert_eq!(unescape(r#"plain"#).unwrap(), "plain");
+        assert_eq!(unescape(r#"a\"b\\c\/d\n\t"#).unwrap(), "a\"b\\c/d\n\t");
+        assert_eq!(unescape(r#"\u00e9\u4E2D"#).unwrap(), "é中");
+        assert_eq!(unescape(r#"x\uD83D\uDE00y"#).unwrap(), "x😀y");
+        assert!(unescape(r#"\uD83D"#).is_err());
+        assert!(unescape(r#"\uDE00\uD83D"#).is_err());
+        assert!(unescape(r#"\u12G4"#).is_err());
+        assert!(unescape(r#"\x"#).is_err());
+    }
+}
@@ -0,0 +1,151 @@
+/// Id of an interned object key. Only meaningful for the `SymbolTable`
+/// it was created by, comparing two keys is a plain integer compare.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct Symbol(u32);
+
+impl Symbol {
+    pub fn id(self) -> u32 {
+        self.0
+    }
+}
+
+const EMPTY: u32 = u32::MAX;
+
+/// Per-document key interner.
+///
+/// Every distinct key is stored once in `arena`, and found back through an
+/// open-addressing table of symbol ids. An array of a million records with
+/// the same keys then only costs a 4 bytes id per key and per record.
+#[derive(Debug, Default, Clone)]
+pub struct SymbolTable {
+    arena: String,
+    spans: Vec<(u32, u32)>,
+    hashes: Vec<u32>,
+    slots: Vec<u32>,
+}
+
+impl SymbolTable {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn len(&self) -> usize {
+        self.spans.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.spans.is_empty()
+    }
+
+    /// Returns the symbol of `key`, adding it to the table if needed.
+    pub fn intern(&mut self, key: &str) -> Symbol {
+        let hash = hash(key.as_bytes());
+        if let Some(sym) = self.find(key, hash) {
+            return sym;
+        }
+
+        // Keep the load factor under 1/2 so probe sequences stay short
+        if (self.spans.len() + 1) * 2 > self.slots.len() {
+            self.grow();
+        }
+
+        let sym = Symbol(self.spans.len() as u32);
+        let start = self.arena.len() as u32;
+        self.arena.push_str(key);
+        self.spans.push((start, self.arena.len() as u32));
+        self.hashes.push(hash);
+        self.insert_slot(sym, hash);
+        sym
+    }
+
+    /// Returns the symbol of `key` if it appears in the document.
+    pub fn get(&self, key: &str) -> Option<Symbol> {
+        if self.slots.is_empty() {
+            return None;
+        }
+        self.find(key, hash(key.as_bytes()))
+    }
+
+    pub fn resolve(&self, sym: Symbol) -> &str {
+        let (start, end) = self.spans[sym.0 as usize];
+        &self.arena[start as usize..end as usize]
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = (Symbol, &str)> {
+        (0..self.spans.len() as u32).map(|i| (Symbol(i), self.resolve(Symbol(i))))
+    }
+
+    fn find(&self, key: &str, hash: u32) -> Option<Symbol> {
+        if self.slots.is_empty() {
+            return None;
+        }
+        let mask = self.slots.len() - 1;
+        let mut i = hash as usize & mask;
+        loop {
+            match self.slots[i] {
+                EMPTY => return None,
+                id => {
+                    let sym = Symbol(id);
+                    if self.hashes[id as usize] == hash && self.resolve(sym) == key {
+                        return Some(sym);
+                    }
+                }
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    fn insert_slot(&mut self, sym: Symbol, hash: u32) {
+        let mask = self.slots.len() - 1;
+        let mut i = hash as usize & mask;
+        while self.slots[i] != EMPTY {
+            i = (i + 1) & mask;
+        }
+        self.slots[i] = sym.0;
+    }
+
+    fn grow(&mut self) {
+        let capacity = (self.slots.len() * 2).max(16);
+        self.slots = vec![EMPTY; capacity];
+        for id in 0..self.spans.len() {
+            self.insert_slot(Symbol(id as u32), self.hashes[id]);
+        }
+    }
+}
+
+/// FNV-1a, keys are short so it beats SipHash by a good margin here.
+fn hash(bytes: &[u8]) -> u32 {
+    let mut h: u32 = 0x811c9dc5;
+    for b in bytes {
+        h ^= *b as u32;
+        h = h.wrapping_mul(0x01000193);
+    }
+    h
+}
+
+#[cfg(test)]
+mod tests {
+    use super::SymbolTable;
+
+    #[test]
+    fn test_intern_same_key() {
+        let mut table = SymbolTable::new();
+        let a = table.intern("key");
+        let b = table.intern("other");
+        assert_eq!(a, table.intern("key"));
+        assert_ne!(a, b);
+        assert_eq!(table.len(), 2);
+        assert_eq!(table.resolve(b), "other");
+    }
+
+    #[test]
+    fn test_intern_many() {
+        let mut table = SymbolTable::new();
+        let syms: Vec<_> = (0..1000).map(|i| table.intern(&format!("k{i}"))).collect();
+        for (i, sym) in syms.iter().enumerate() {
+            assert_eq!(table.get(&format!("k{i}")), Some(*sym));
+        }
+        assert_eq!(table.get("missing"), None);
+        assert_eq!(table.intern(""), table.intern(""));
+    }
+}
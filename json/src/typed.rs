@@ -0,0 +1,400 @@
+use std::borrow::Cow;
+
+use crate::error::{Error, Position};
+use crate::strings::unescape;
+use crate::validate::{scan_container, scan_number, scan_string};
+use crate::DEFAULT_MAX_DEPTH;
+
+/// Types that can be read straight from json, without building a `Value`.
+///
+/// Usually derived with `#[derive(FromJson)]` for structs.
+pub trait FromJson: Sized {
+    fn from_json(cursor: &mut Cursor<'_>) -> Result<Self, Error>;
+
+    /// Value used when the field is missing from the object, if any.
+    fn missing() -> Option<Self> {
+        None
+    }
+}
+
+/// Parses `input` into a `T`, locating the error if it fails.
+pub fn from_str<T: FromJson>(input: &str) -> Result<T, Error> {
+    let mut cursor = Cursor::new(input);
+    T::from_json(&mut cursor)
+        .and_then(|v| cursor.finish().map(|_| v))
+        .map_err(|e| Error::At(Position::locate(input.as_bytes(), cursor.pos), Box::new(e)))
+}
+
+/// Pull lexer used by `FromJson` implementations.
+///
+/// It follows the same rules as `tokenize`, but reads values only when
+/// asked to, and values nobody asked for are skipped by the state machine
+/// of `validate`, which checks them without building anything.
+pub struct Cursor<'a> {
+    text: &'a str,
+    pos: usize,
+    fresh: bool,    // True right after an opening bracket
+    stack: Vec<u8>, // Containers open in the value being skipped
+}
+
+impl<'a> Cursor<'a> {
+    pub fn new(text: &'a str) -> Self {
+        Cursor {
+            text,
+            pos: 0,
+            fresh: false,
+            stack: Vec::new(),
+        }
+    }
+
+    /// Offset of the next byte to read.
+    pub(crate) fn pos(&self) -> usize {
+        self.pos
+    }
+
+    fn bytes(&self) -> &'a [u8] {
+        self.text.as_bytes()
+    }
+
+    /// Next byte that isn't a whitespace, which is left unread.
+    pub(crate) fn peek(&mut self) -> Option<u8> {
+        while let Some(b' ' | b'\n' | b'\r' | b'\t') = self.bytes().get(self.pos) {
+            self.pos += 1;
+        }
+        self.bytes().get(self.pos).copied()
+    }
+
+    fn expect(&mut self, b: u8) -> Result<(), Error> {
+        match self.peek() {
+            Some(c) if c == b => {
+                self.pos += 1;
+                Ok(())
+            }
+            Some(c) => Err(Error::UnrecognizedToken(c as char, self.pos)),
+            None => Err(Error::MissingValue),
+        }
+    }
+
+    /// Fails if anything but whitespaces is left.
+    pub fn finish(&mut self) -> Result<(), Error> {
+        match self.peek() {
+            None => Ok(()),
+            Some(_) => Err(Error::ExtraValue),
+        }
+    }
+
+    pub fn begin_object(&mut self) -> Result<(), Error> {
+        self.expect(b'{')?;
+        self.fresh = true;
+        Ok(())
+    }
+
+    /// Reads the next key of the object and its colon, None at its end.
+    pub fn next_key(&mut self) -> Result<Option<Cow<'a, str>>, Error> {
+        if !self.next_item_of(b'}')? {
+            return Ok(None);
+        }
+        let key = match self.peek() {
+            Some(b'"') => self.str()?,
+            Some(b'}') => return Err(Error::TrailingComma),
+            Some(c) => return Err(Error::UnrecognizedToken(c as char, self.pos)),
+            None => return Err(Error::MissingClosingBracket),
+        };
+        self.expect(b':')?;
+        Ok(Some(key))
+    }
+
+    pub fn begin_array(&mut self) -> Result<(), Error> {
+        self.expect(b'[')?;
+        self.fresh = true;
+        Ok(())
+    }
+
+    /// True if another value follows in the array.
+    pub fn next_item(&mut self) -> Result<bool, Error> {
+        if !self.next_item_of(b']')? {
+            return Ok(false);
+        }
+        match self.peek() {
+            Some(b']') => Err(Error::TrailingComma),
+            _ => Ok(true),
+        }
+    }
+
+    /// Consumes the comma before an item or the closing bracket.
+    fn next_item_of(&mut self, close: u8) -> Result<bool, Error> {
+        let fresh = std::mem::replace(&mut self.fresh, false);
+        match self.peek() {
+            Some(c) if c == close => {
+                self.pos += 1;
+                Ok(false)
+            }
+            Some(b',') if !fresh => {
+                self.pos += 1;
+                Ok(true)
+            }
+            _ if fresh => Ok(true),
+            Some(c) => Err(Error::UnrecognizedToken(c as char, self.pos)),
+            None => Err(Error::MissingClosingBracket),
+        }
+    }
+
+    /// Reads a string, only allocating if it holds escape sequences.
+    pub fn str(&mut self) -> Result<Cow<'a, str>, Error> {
+        let s = self.raw_str()?;
+        match s.bytes().find(|b| *b < 0x20) {
+            Some(b'\n') => Err(Error::LineBreakInLitteral),
+            Some(c) => Err(Error::ControlCharInLitteral(c as char)),
+            None => unescape(s),
+        }
+    }
+
+    fn raw_str(&mut self) -> Result<&'a str, Error> {
+        self.expect(b'"')?;
+        let start = self.pos;
+        let end = self.str_end(start)?;
+        self.pos = end + 1;
+        Ok(&self.text[start..end])
+    }
+
+    /// Index of the quote closing the string starting at `i`.
+    fn str_end(&self, mut i: usize) -> Result<usize, Error> {
+        let bytes = self.bytes();
+        loop {
+            match bytes.get(i) {
+                Some(b'"') => return Ok(i),
+                Some(b'\\') => i += 2,
+                Some(_) => i += 1,
+                None => return Err(Error::MismatchQuote),
+            }
+        }
+    }
+
+    /// Reads the text of a number, checked with the grammar of `tokenize`.
+    pub fn number(&mut self) -> Result<&'a str, Error> {
+        match self.peek() {
+            Some(b'-' | b'0'..=b'9') => (),
+            Some(c) => return Err(Error::UnrecognizedToken(c as char, self.pos)),
+            None => return Err(Error::MissingValue),
+        }
+        let start = self.pos;
+        let last = scan_number(self.bytes(), start).map_err(|(_, e)| e)?;
+        self.pos = last + 1;
+        Ok(&self.text[start..self.pos])
+    }
+
+    pub fn bool(&mut self) -> Result<bool, Error> {
+        match self.peek() {
+            Some(b't') => self.word("true").map(|_| true),
+            Some(b'f') => self.word("false").map(|_| false),
+            Some(c) => Err(Error::UnrecognizedToken(c as char, self.pos)),
+            None => Err(Error::MissingValue),
+        }
+    }
+
+    /// Consumes a null if it comes next.
+    pub fn null(&mut self) -> Result<bool, Error> {
+        match self.peek() {
+            Some(b'n') => self.word("null").map(|_| true),
+            _ => Ok(false),
+        }
+    }
+
+    fn word(&mut self, word: &str) -> Result<(), Error> {
+        if self.text[self.pos..].starts_with(word) {
+            self.pos += word.len();
+            Ok(())
+        } else {
+            Err(Error::UnrecognizedToken(
+                self.bytes()[self.pos] as char,
+                self.pos,
+            ))
+        }
+    }
+
+    /// Skips the next value and returns its text, as found in the input.
+    pub fn raw_value(&mut self) -> Result<&'a str, Error> {
+        self.peek();
+        let start = self.pos;
+        self.skip_value()?;
+        Ok(&self.text[start..self.pos])
+    }
+
+    /// Skips the next value, checked like `validate` does, its containers
+    /// nested at most `DEFAULT_MAX_DEPTH` deep.
+    pub fn skip_value(&mut self) -> Result<(), Error> {
+        let end = match self.peek() {
+            Some(b'"') => scan_string(self.bytes(), self.pos + 1),
+            Some(b'{' | b'[') => {
+                self.stack.clear();
+                scan_container(self.bytes(), self.pos, &mut self.stack, DEFAULT_MAX_DEPTH)
+            }
+            Some(b't' | b'f') => return self.bool().map(|_| ()),
+            Some(b'n') => return self.null().map(|_| ()),
+            _ => return self.number().map(|_| ()),
+        };
+        match end {
+            Ok(end) => {
+                self.pos = end + 1;
+                Ok(())
+            }
+            Err((at, e)) => {
+                self.pos = at;
+                Err(e)
+            }
+        }
+    }
+}
+
+impl FromJson for bool {
+    fn from_json(cursor: &mut Cursor<'_>) -> Result<Self, Error> {
+        cursor.bool()
+    }
+}
+
+impl FromJson for String {
+    fn from_json(cursor: &mut Cursor<'_>) -> Result<Self, Error> {
+        cursor.str().map(Cow::into_owned)
+    }
+}
+
+macro_rules! impl_from_json_number {
+    ($($t:ty),*) => {
+        $(impl FromJson for $t {
+            fn from_json(cursor: &mut Cursor<'_>) -> Result<Self, Error> {
+                cursor.number()?.parse().map_err(|_| Error::InvalidNumber)
+            }
+        })*
+    };
+}
+
+impl_from_json_number!(f64, f32, i64, i32, u64, u32, usize);
+
+impl<T: FromJson> FromJson for Option<T> {
+    fn from_json(cursor: &mut Cursor<'_>) -> Result<Self, Error> {
+        if cursor.null()? {
+            Ok(None)
+        } else {
+            T::from_json(cursor).map(Some)
+        }
+    }
+
+    fn missing() -> Option<Self> {
+        Some(None)
+    }
+}
+
+impl<T: FromJson> FromJson for Vec<T> {
+    fn from_json(cursor: &mut Cursor<'_>) -> Result<Self, Error> {
+        let mut values = Vec::new();
+        cursor.begin_array()?;
+        while cursor.next_item()? {
+            values.push(T::from_json(cursor)?);
+        }
+        Ok(values)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{from_str, Error, FromJson};
+
+    #[derive(FromJson, Debug, PartialEq)]
+    struct Tag {
+        name: String,
+        weight: Option<f64>,
+    }
+
+    #[derive(FromJson, Debug, PartialEq)]
+    struct User {
+        id: u64,
+        pub r#type: String,
+        tags: Vec<Tag>,
+        active: bool,
+        email: Option<String>,
+    }
+
+    #[test]
+    fn test_derive() {
+        let user: User = from_str(
+            r#"{
+                "id": 42,
+                "skipped": {"a": [1, {"b": "]}"}], "c": null},
+                "type": "ad\u006Din",
+                "tags": [{"name": "x", "weight": 0.5}, {"weight": null, "name": "y"}],
+                "active": true
+            }"#,
+        )
+        .unwrap();
+
+        assert_eq!(
+            user,
+            User {
+                id: 42,
+                r#type: "admin".to_string(),
+                tags: vec![
+                    Tag {
+                        name: "x".to_string(),
+                        weight: Some(0.5)
+                    },
+                    Tag {
+                        name: "y".to_string(),
+                        weight: None
+                    }
+                ],
+                active: true,
+                email: None,
+            }
+        );
+    }
+
+    #[test]
+    fn test_derive_errors() {
+        let missing = from_str::<Tag>(r#"{"weight": 1}"#);
+        assert!(
+            matches!(missing, Err(Error::At(_, e)) if matches!(*e, Error::MissingField("name")))
+        );
+
+        assert!(from_str::<Tag>(r#"{"name": "a",}"#).is_err());
+        assert!(from_str::<Tag>(r#"{"name": "a" "weight": 1}"#).is_err());
+        assert!(from_str::<Tag>(r#"{"name": 1}"#).is_err());
+        assert!(from_str::<Vec<u32>>(r#"[1, 2,]"#).is_err());
+        assert!(from_str::<Vec<u32>>(r#"[1, 2] 3"#).is_err());
+        assert_eq!(from_str::<Vec<u32>>(r#" [ ] "#).unwrap(), vec![]);
+
+        // Numbers follow the json grammar, not the one of Rust
+        for invalid in ["01", "1.", "-", "1e", ".5", "+1"] {
+            assert!(from_str::<f64>(invalid).is_err(), "{invalid}");
+        }
+        assert_eq!(from_str::<f64>("-0.5e1").unwrap(), -5.0);
+
+        // Skipped values are checked as well
+        for skipped in [
+            "[@#$]",
+            "[1 2]",
+            r#"{"a" 1}"#,
+            r#"{"a": 1,}"#,
+            "[01]",
+            "[tru]",
+            r#""\q""#,
+            r#"["\u12"]"#,
+            "\"a\tb\"",
+        ] {
+            let input = format!(r#"{{"x": {skipped}, "name": "a"}}"#);
+            assert!(from_str::<Tag>(&input).is_err(), "{input}");
+        }
+        assert!(from_str::<Tag>(r#"{"x": [1, {"y": "\u00e9"}], "name": "a"}"#).is_ok());
+        assert!(from_str::<Tag>(r#"{"x": [1}, "name": "a"}"#).is_err());
+        assert!(from_str::<Tag>(r#"{"x": {"a": [}], "name": "a"}"#).is_err());
+        let deep = format!("{}}}{}", "[".repeat(100), "]".repeat(99));
+        assert!(from_str::<Tag>(&format!(r#"{{"x": {deep}, "name": "a"}}"#)).is_err());
+        let deep = format!("{}{}", "[".repeat(100), "]".repeat(100));
+        assert!(from_str::<Tag>(&format!(r#"{{"x": {deep}, "name": "a"}}"#)).is_ok());
+
+        // A field given twice is ambiguous
+        let repeated = from_str::<Tag>(r#"{"name": "a", "name": "b"}"#);
+        assert!(
+            matches!(repeated, Err(Error::At(_, e)) if matches!(*e, Error::DuplicateKey(ref k) if k == "name"))
+        );
+    }
+}
@@ -0,0 +1,302 @@
+use crate::error::{Error, Position};
+use crate::strings::{unicode_escape, validate_utf8};
+use crate::DEFAULT_MAX_DEPTH;
+
+#[derive(Clone, Copy, PartialEq)]
+enum State {
+    Start,
+    FirstValue, // Right after '[', may be closed at once
+    Value,
+    FirstKey, // Right after '{', may be closed at once
+    Key,
+    Colon,
+    AfterValue,
+}
+
+const OBJECT: u8 = b'{';
+const ARRAY: u8 = b'[';
+
+/// Checks that `input` is a valid json document without building it.
+///
+/// Only the kind of the currently open containers is kept around, so memory
+/// is proportional to the nesting depth and no value is ever allocated.
+/// The error returned is `Error::At`, locating the first invalid byte.
+pub fn validate(input: &[u8]) -> Result<(), Error> {
+    validate_with_depth(input, DEFAULT_MAX_DEPTH)
+}
+
+pub fn validate_with_depth(input: &[u8], max_depth: usize) -> Result<(), Error> {
+    validate_in(input, &mut Vec::new(), max_depth)
+}
+
+/// Same as `validate_with_depth`, using the caller's `stack` so that it can
+/// be reused from one document to the next.
+pub(crate) fn validate_in(
+    input: &[u8],
+    stack: &mut Vec<u8>,
+    max_depth: usize,
+) -> Result<(), Error> {
+    // Checking the encoding of the whole input at once lets the state
+    // machine treat non-ascii bytes of strings like any other byte
+    validate_utf8(input)?;
+    stack.clear();
+    run(input, stack, max_depth)
+        .map_err(|(offset, e)| Error::At(Position::locate(input, offset), Box::new(e)))
+}
+
+fn run(input: &[u8], stack: &mut Vec<u8>, max_depth: usize) -> Result<(), (usize, Error)> {
+    let end = scan_container(input, 0, stack, max_depth)?;
+    match input[end + 1..]
+        .iter()
+        .position(|b| !matches!(b, b' ' | b'\n' | b'\r' | b'\t'))
+    {
+        Some(p) => Err((end + 1 + p, Error::ExtraValue)),
+        None => Ok(()),
+    }
+}
+
+/// Scans the object or array starting at `i`, after any whitespace, and
+/// returns the index of its last byte. `stack` must be empty.
+pub(crate) fn scan_container(
+    input: &[u8],
+    mut i: usize,
+    stack: &mut Vec<u8>,
+    max_depth: usize,
+) -> Result<usize, (usize, Error)> {
+    let mut state = State::Start;
+
+    while i < input.len() {
+        let b = input[i];
+        if matches!(b, b' ' | b'\n' | b'\r' | b'\t') {
+            i += 1;
+            continue;
+        }
+
+        state = match state {
+            State::Start => match b {
+                b'{' | b'[' => open(stack, b, max_depth).map_err(|e| (i, e))?,
+                _ => return Err((i, Error::MustBeginWithBracket)),
+            },
+            State::FirstValue | State::Value => match b {
+                b']' if state == State::FirstValue => close(stack, b, i)?,
+                b'{' | b'[' => open(stack, b, max_depth).map_err(|e| (i, e))?,
+                b'"' => {
+                    i = scan_string(input, i + 1)?;
+                    State::AfterValue
+                }
+                b't' => {
+                    i = scan_word(input, i, b"true")?;
+                    State::AfterValue
+                }
+                b'f' => {
+                    i = scan_word(input, i, b"false")?;
+                    State::AfterValue
+                }
+                b'n' => {
+                    i = scan_word(input, i, b"null")?;
+                    State::AfterValue
+                }
+                b'-' | b'0'..=b'9' => {
+                    i = scan_number(input, i)?;
+                    State::AfterValue
+                }
+                b']' => return Err((i, Error::TrailingComma)),
+                b',' => return Err((i, Error::MissingValue)),
+                _ => return Err((i, unrecognized(input, i))),
+            },
+            State::FirstKey | State::Key => match b {
+                b'}' if state == State::FirstKey => close(stack, b, i)?,
+                b'"' => {
+                    i = scan_string(input, i + 1)?;
+                    State::Colon
+                }
+                b'}' | b',' => return Err((i, Error::TrailingComma)),
+                _ => return Err((i, unrecognized(input, i))),
+            },
+            State::Colon => match b {
+                b':' => State::Value,
+                _ => return Err((i, unrecognized(input, i))),
+            },
+            State::AfterValue => match (stack.last(), b) {
+                (Some(&OBJECT), b',') => State::Key,
+                (Some(&ARRAY), b',') => State::Value,
+                (Some(&OBJECT), b'}') | (Some(&ARRAY), b']') => close(stack, b, i)?,
+                _ => return Err((i, unrecognized(input, i))),
+            },
+        };
+        if state == State::AfterValue && stack.is_empty() {
+            return Ok(i);
+        }
+        i += 1;
+    }
+
+    match state {
+        State::Start => Err((i, Error::MustBeginWithBracket)),
+        State::Colon | State::Value => Err((i, Error::MissingValue)),
+        _ => Err((i, Error::MissingClosingBracket)),
+    }
+}
+
+fn open(stack: &mut Vec<u8>, b: u8, max_depth: usize) -> Result<State, Error> {
+    if stack.len() >= max_depth {
+        return Err(Error::TooDeep(max_depth));
+    }
+    stack.push(b);
+    Ok(if b == OBJECT {
+        State::FirstKey
+    } else {
+        State::FirstValue
+    })
+}
+
+fn close(stack: &mut Vec<u8>, b: u8, i: usize) -> Result<State, (usize, Error)> {
+    match (stack.pop(), b) {
+        (Some(OBJECT), b'}') | (Some(ARRAY), b']') => Ok(State::AfterValue),
+        _ => Err((i, Error::UnrecognizedToken(b as char, i))),
+    }
+}
+
+fn unrecognized(input: &[u8], i: usize) -> Error {
+    let c = std::str::from_utf8(&input[i..input.len().min(i + 4)])
+        .ok()
+        .or_else(|| std::str::from_utf8(&input[i..i + 1]).ok())
+        .and_then(|s| s.chars().next())
+        .unwrap_or(char::REPLACEMENT_CHARACTER);
+    Error::UnrecognizedToken(c, i)
+}
+
+/// Scans the string starting at `i` (after the opening quote), and returns
+/// the index of its closing quote.
+pub(crate) fn scan_string(input: &[u8], mut i: usize) -> Result<usize, (usize, Error)> {
+    loop {
+        match input.get(i) {
+            None => return Err((i, Error::MismatchQuote)),
+            Some(b'"') => return Ok(i),
+            Some(b'\\') => {
+                match input.get(i + 1) {
+                    Some(b'"' | b'\\' | b'/' | b'b' | b'f' | b'n' | b'r' | b't') => (),
+                    Some(b'u') => {
+                        let len = unicode_escape(&input[i..]).map_err(|e| (i, e))?.1;
+                        i += len - 2;
+                    }
+                    Some(_) => return Err((i + 1, Error::InvalidEscape(input[i + 1] as char))),
+                    None => return Err((i, Error::MismatchQuote)),
+                }
+                i += 2;
+            }
+            Some(b'\n') => return Err((i, Error::LineBreakInLitteral)),
+            Some(&b) if b < 0x20 => return Err((i, Error::ControlCharInLitteral(b as char))),
+            Some(_) => i += 1,
+        }
+    }
+}
+
+/// Returns the index of the last byte of `word`.
+fn scan_word(input: &[u8], i: usize, word: &[u8]) -> Result<usize, (usize, Error)> {
+    for (j, expected) in word.iter().enumerate() {
+        match input.get(i + j) {
+            Some(b) if b == expected => (),
+            Some(_) => return Err((i + j, unrecognized(input, i + j))),
+            None => return Err((i + j, Error::ParsingError)),
+        }
+    }
+    Ok(i + word.len() - 1)
+}
+
+/// Returns the index of the last byte of the number.
+pub(crate) fn scan_number(input: &[u8], mut i: usize) -> Result<usize, (usize, Error)> {
+    let start = i;
+    let digits = |i: &mut usize| {
+        let from = *i;
+        while input.get(*i).is_some_and(u8::is_ascii_digit) {
+            *i += 1;
+        }
+        *i > from
+    };
+
+    if input.get(i) == Some(&b'-') {
+        i += 1;
+    }
+    match input.get(i) {
+        Some(b'0') => i += 1,
+        Some(b'1'..=b'9') => {
+            digits(&mut i);
+        }
+        _ => return Err((start, Error::InvalidNumber)),
+    }
+    if input.get(i) == Some(&b'.') {
+        i += 1;
+        if !digits(&mut i) {
+            return Err((start, Error::InvalidNumber));
+        }
+    }
+    if matches!(input.get(i), Some(b'e' | b'E')) {
+        i += 1;
+        if matches!(input.get(i), Some(b'+' | b'-')) {
+            i += 1;
+        }
+        if !digits(&mut i) {
+            return Err((start, Error::InvalidNumber));
+        }
+    }
+    // A number directly followed by another digit means a leading zero
+    if input.get(i).is_some_and(u8::is_ascii_digit) {
+        return Err((start, Error::InvalidNumber));
+    }
+    Ok(i - 1)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{validate, validate_with_depth};
+    use crate::error::{Error, Position};
+
+    fn position(input: &str) -> Position {
+        match validate(input.as_bytes()) {
+            Err(Error::At(p, _)) => p,
+            r => panic!("expected a located error, got {r:?}"),
+        }
+    }
+
+    #[test]
+    fn test_validate_steps() {
+        for step in 1..=5 {
+            for entry in std::fs::read_dir(format!("tests/step{step}/")).unwrap() {
+                let path = entry.unwrap().path();
+                let name = path.file_name().unwrap().to_str().unwrap().to_string();
+                let input = std::fs::read(&path).unwrap();
+                let valid = name.starts_with("valid") || name.starts_with("pass");
+                assert_eq!(validate(&input).is_ok(), valid, "Failed on file {:?}", path);
+            }
+        }
+    }
+
+    #[test]
+    fn test_validate_strict() {
+        assert!(validate(br#"[01]"#).is_err());
+        assert!(validate(br#"["\x15"]"#).is_err());
+        assert!(validate(br#"["\u12"]"#).is_err());
+        assert!(validate(b"[\"\xff\"]").is_err());
+        assert!(validate("[\"\u{4e2d}\u{6587}\", -0.5e+3, {\"a\": {}}]".as_bytes()).is_ok());
+    }
+
+    #[test]
+    fn test_validate_position() {
+        let p = position("{\n  \"a\": 1,\n  \"b\" 2\n}");
+        assert_eq!((p.line, p.column, p.offset), (3, 7, 18));
+
+        let p = position("[\"é\", tru]");
+        assert_eq!((p.line, p.column), (1, 10));
+    }
+
+    #[test]
+    fn test_validate_deep() {
+        let depth = 1_000_000;
+        let mut input = "[".repeat(depth);
+        input.push_str(&"]".repeat(depth));
+        assert!(validate_with_depth(input.as_bytes(), depth).is_ok());
+        assert!(validate(input.as_bytes()).is_err());
+        input.pop();
+        assert!(validate_with_depth(input.as_bytes(), depth).is_err());
+    }
+}
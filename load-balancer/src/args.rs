@@ -0,0 +1,102 @@
+use std::time::Duration;
+
+use crate::balance::{Key, Policy};
+use crate::health::Probe;
+use crate::Error;
+
+pub struct Args {
+    pub listen: String,
+    pub backends: Vec<String>,
+    pub policy: Policy,
+    pub probe: Probe,
+    pub interval: Duration,
+    /// Consecutive successes putting an unhealthy backend back in rotation.
+    pub rise: u32,
+    /// Consecutive failures taking a backend out of rotation.
+    pub fall: u32,
+}
+
+impl Args {
+    pub fn build() -> Result<Self, Error> {
+        let args: Vec<String> = std::env::args().collect();
+        let mut listen = "127.0.0.1:5050".to_string();
+        let mut backends = Vec::new();
+        let mut policy = Policy::RoundRobin;
+        let mut hash_key = Key::Path;
+        let mut hash_bound = 0.25;
+        let mut probe = Probe::Tcp;
+        let mut interval = Duration::from_secs(2);
+        let mut rise = 2;
+        let mut fall = 3;
+
+        let bad_option = |arg: &str| Error(format!("Bad option : {arg}"));
+        let mut iter = args.iter().skip(1);
+        while let Some(arg) = iter.next() {
+            if arg.starts_with("-") {
+                match arg.as_str() {
+                    "--listen" => match iter.next() {
+                        Some(s) => listen = s.to_string(),
+                        None => return Err(bad_option(arg)),
+                    },
+                    "--policy" => match iter.next().and_then(|s| Policy::parse(s)) {
+                        Some(p) => policy = p,
+                        None => return Err(bad_option(arg)),
+                    },
+                    "--hash-key" => match iter.next().and_then(|s| Key::parse(s)) {
+                        Some(k) => hash_key = k,
+                        None => return Err(bad_option(arg)),
+                    },
+                    "--hash-bound" => {
+                        hash_bound = match iter.next().map(|s| s.parse()) {
+                            Some(Ok(bound)) if bound > 0.0 => bound,
+                            _ => return Err(bad_option(arg)),
+                        }
+                    }
+                    "--health-path" => match iter.next() {
+                        Some(s) if s.starts_with('/') => probe = Probe::Http(s.to_string()),
+                        _ => return Err(bad_option(arg)),
+                    },
+                    "--health-interval" => {
+                        interval = match iter.next().map(|s| s.parse()) {
+                            Some(Ok(secs)) if secs > 0.0 => Duration::from_secs_f64(secs),
+                            _ => return Err(bad_option(arg)),
+                        }
+                    }
+                    "--rise" | "--fall" => {
+                        let n = match iter.next().map(|s| s.parse()) {
+                            Some(Ok(n)) if n > 0 => n,
+                            _ => return Err(bad_option(arg)),
+                        };
+                        match arg.as_str() {
+                            "--rise" => rise = n,
+                            _ => fall = n,
+                        }
+                    }
+                    _ => return Err(bad_option(arg)),
+                }
+            } else {
+                backends.push(arg.to_string());
+            }
+        }
+
+        if backends.is_empty() {
+            backends = ["localhost:8080", "localhost:8081", "localhost:8082"]
+                .map(String::from)
+                .to_vec();
+        }
+
+        if let Policy::ConsistentHash { key, bound } = &mut policy {
+            (*key, *bound) = (hash_key, hash_bound);
+        }
+
+        Ok(Args {
+            listen,
+            backends,
+            policy,
+            probe,
+            interval,
+            rise,
+            fall,
+        })
+    }
+}
@@ -0,0 +1,445 @@
+use std::cell::Cell;
+use std::collections::hash_map::{DefaultHasher, RandomState};
+use std::hash::{BuildHasher, Hash, Hasher};
+use std::io::ErrorKind;
+use std::net::{SocketAddr, ToSocketAddrs};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::time::{Duration, Instant};
+
+use crate::health::Health;
+
+/// Time for the weight of a latency sample to decay by e.
+const DECAY: Duration = Duration::from_secs(10);
+/// Cost of a backend with requests in flight but no latency sample yet,
+/// which then gets no other request until the first one completes.
+const PENALTY: f64 = 1e15;
+/// Points of each backend on the hash ring.
+const VIRTUAL_NODES: usize = 100;
+
+/// How the backend of a request is picked among the healthy ones.
+#[derive(Clone, Debug, PartialEq)]
+pub enum Policy {
+    /// Each in turn.
+    RoundRobin,
+    /// The one with the fewest requests in flight.
+    LeastRequests,
+    /// The one with the fewest requests in flight of two picked at random,
+    /// which avoids every worker rushing to the same least loaded backend.
+    TwoChoices,
+    /// The cheapest of two picked at random, the cost being a moving
+    /// average of the latency times the requests in flight. The average
+    /// goes up at once on a slower response, and down slowly, so that a
+    /// backend slowing down is avoided before it times out.
+    PeakEwma,
+    /// The same backend for the same key, so that it finds what it cached,
+    /// unless it serves more than `1 + bound` times the average load, then
+    /// the next one on the ring which doesn't.
+    ConsistentHash { key: Key, bound: f64 },
+}
+
+/// What requests with the same consistent hash share.
+#[derive(Clone, Debug, PartialEq)]
+pub enum Key {
+    /// The target without the query.
+    Path,
+    /// The value of a header, empty when missing.
+    Header(String),
+    ClientIp,
+}
+
+impl Key {
+    pub fn parse(name: &str) -> Option<Self> {
+        match name {
+            "path" => Some(Key::Path),
+            "ip" => Some(Key::ClientIp),
+            _ => match name.strip_prefix("header:") {
+                Some(header) if !header.is_empty() => Some(Key::Header(header.to_string())),
+                _ => None,
+            },
+        }
+    }
+}
+
+impl Policy {
+    pub fn parse(name: &str) -> Option<Self> {
+        match name {
+            "round-robin" => Some(Policy::RoundRobin),
+            "least-requests" => Some(Policy::LeastRequests),
+            "two-choices" => Some(Policy::TwoChoices),
+            "peak-ewma" => Some(Policy::PeakEwma),
+            "consistent-hash" => Some(Policy::ConsistentHash {
+                key: Key::Path,
+                bound: 0.25,
+            }),
+            _ => None,
+        }
+    }
+}
+
+/// Each backend on its own cache line, as its counters are updated by all
+/// the workers.
+#[repr(align(64))]
+pub struct Backend {
+    pub name: String,
+    pub addr: SocketAddr,
+    health: Health,
+    in_flight: AtomicUsize,
+    /// Latency average, as the bits of a f64 number of nanoseconds.
+    latency: AtomicU64,
+    /// When it was last updated, in nanoseconds since `Backends::start`.
+    updated: AtomicU64,
+}
+
+/// The backends, and the requests each one serves.
+pub struct Backends {
+    pub list: Vec<Backend>,
+    policy: Policy,
+    /// Sorted points of the backends on the hash ring.
+    ring: Vec<(u64, usize)>,
+    next: AtomicUsize,
+    start: Instant,
+    rise: u32,
+    fall: u32,
+}
+
+impl Backends {
+    pub fn resolve(
+        names: &[String],
+        policy: Policy,
+        rise: u32,
+        fall: u32,
+    ) -> std::io::Result<Self> {
+        let mut list = Vec::new();
+        for name in names {
+            // The servers may well only listen on ipv4 for "localhost"
+            let resolved: Vec<_> = name.to_socket_addrs()?.collect();
+            let Some(addr) = resolved.iter().find(|a| a.is_ipv4()).or(resolved.first()) else {
+                return Err(ErrorKind::NotFound.into());
+            };
+            list.push(Backend {
+                name: name.clone(),
+                addr: *addr,
+                health: Health::new(),
+                in_flight: AtomicUsize::new(0),
+                latency: AtomicU64::new(0),
+                updated: AtomicU64::new(0),
+            });
+        }
+        let mut ring: Vec<_> = (0..list.len())
+            .flat_map(|i| (0..VIRTUAL_NODES).map(move |v| (i, v)))
+            .map(|(i, v)| (hash((&list[i].name, v)), i))
+            .collect();
+        ring.sort_unstable();
+        Ok(Backends {
+            list,
+            policy,
+            ring,
+            next: AtomicUsize::new(0),
+            start: Instant::now(),
+            rise,
+            fall,
+        })
+    }
+
+    /// What the requests are hashed on, if they are.
+    pub fn hash_key(&self) -> Option<&Key> {
+        match &self.policy {
+            Policy::ConsistentHash { key, .. } => Some(key),
+            _ => None,
+        }
+    }
+
+    /// Index of the backend for the next request, whose key hashes to
+    /// `hash`, none if all are down. The request is in flight until it is
+    /// released.
+    pub fn pick(&self, hash: u64) -> Option<usize> {
+        let picked = match self.policy {
+            Policy::RoundRobin => self.round_robin(),
+            Policy::LeastRequests => self.least_requests(),
+            Policy::TwoChoices => self.two_choices(|i| self.in_flight(i)),
+            Policy::PeakEwma => {
+                let now = self.now();
+                self.two_choices(|i| self.cost(i, now))
+            }
+            Policy::ConsistentHash { bound, .. } => self.consistent_hash(hash, bound),
+        }?;
+        self.list[picked].in_flight.fetch_add(1, Ordering::Relaxed);
+        Some(picked)
+    }
+
+    /// Ends a request picked for backend `i`.
+    pub fn release(&self, i: usize) {
+        self.list[i].in_flight.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    /// Records the time backend `i` took to respond. Concurrent updates
+    /// may lose a sample.
+    pub fn latency(&self, i: usize, rtt: Duration) {
+        let backend = &self.list[i];
+        let now = self.now();
+        let rtt = rtt.as_nanos() as f64;
+        let average = f64::from_bits(backend.latency.load(Ordering::Relaxed));
+        let elapsed = now.saturating_sub(backend.updated.swap(now, Ordering::Relaxed));
+        let average = match rtt > average {
+            true => rtt,
+            false => {
+                let w = (-(elapsed as f64) / DECAY.as_nanos() as f64).exp();
+                average * w + rtt * (1.0 - w)
+            }
+        };
+        backend.latency.store(average.to_bits(), Ordering::Relaxed);
+    }
+
+    /// Records a request served or a probe passed by a backend.
+    pub fn success(&self, i: usize) {
+        if self.list[i].health.success(self.rise) {
+            log!("{} is back in rotation", self.list[i].name);
+        }
+    }
+
+    /// Records a request or a probe failed by a backend.
+    pub fn failure(&self, i: usize) {
+        if self.list[i].health.failure(self.fall) {
+            log!("{} is out of rotation", self.list[i].name);
+        }
+    }
+
+    /// First healthy backend from `start` on, wrapping around.
+    fn healthy_from(&self, start: usize) -> Option<usize> {
+        (0..self.list.len())
+            .map(|i| (start + i) % self.list.len())
+            .find(|&i| self.is_healthy(i))
+    }
+
+    fn in_flight(&self, i: usize) -> usize {
+        self.list[i].in_flight.load(Ordering::Relaxed)
+    }
+
+    fn now(&self) -> u64 {
+        self.start.elapsed().as_nanos() as u64
+    }
+
+    /// Expected latency of a new request to backend `i`. The average keeps
+    /// decaying while no sample comes, giving a backend which was slow its
+    /// chance again.
+    fn cost(&self, i: usize, now: u64) -> f64 {
+        let backend = &self.list[i];
+        let in_flight = self.in_flight(i) as f64;
+        let average = f64::from_bits(backend.latency.load(Ordering::Relaxed));
+        if average == 0.0 && in_flight > 0.0 {
+            return PENALTY + in_flight;
+        }
+        let elapsed = now.saturating_sub(backend.updated.load(Ordering::Relaxed));
+        average * (-(elapsed as f64) / DECAY.as_nanos() as f64).exp() * (in_flight + 1.0)
+    }
+
+    fn is_healthy(&self, i: usize) -> bool {
+        self.list[i].health.is_healthy()
+    }
+
+    /// First backend from the point of `hash` on the ring which has room
+    /// for one more request.
+    fn consistent_hash(&self, hash: u64, bound: f64) -> Option<usize> {
+        let healthy = (0..self.list.len()).filter(|&i| self.is_healthy(i));
+        let (count, total) = healthy.fold((0, 0), |(n, m), i| (n + 1, m + self.in_flight(i)));
+        if count == 0 {
+            return None;
+        }
+        // Above the average with the new request, by a margin for the keys
+        // to keep their backend most of the time
+        let capacity = ((total + 1) as f64 * (1.0 + bound) / count as f64).ceil() as usize;
+        let start = self.ring.partition_point(|&(point, _)| point < hash);
+        let nodes = self.ring[start..].iter().chain(&self.ring[..start]);
+        nodes
+            .map(|&(_, i)| i)
+            .find(|&i| self.is_healthy(i) && self.in_flight(i) < capacity)
+    }
+
+    /// Each healthy backend in turn: the cursor goes over the healthy ones
+    /// only, so that those after a backend down don't get its share too.
+    fn round_robin(&self) -> Option<usize> {
+        let next = self.next.fetch_add(1, Ordering::Relaxed);
+        let healthy = (0..self.list.len()).filter(|&i| self.is_healthy(i));
+        let count = healthy.clone().count();
+        if count == 0 {
+            return None;
+        }
+        // The health may change in between, any healthy one will do then
+        healthy
+            .clone()
+            .nth(next % count)
+            .or_else(|| self.healthy_from(next))
+    }
+
+    fn least_requests(&self) -> Option<usize> {
+        // Ties go to each backend in turn, not always to the first one
+        let start = self.next.fetch_add(1, Ordering::Relaxed);
+        (0..self.list.len())
+            .map(|i| (start + i) % self.list.len())
+            .filter(|&i| self.is_healthy(i))
+            .min_by_key(|&i| self.in_flight(i))
+    }
+
+    /// The least loaded of two healthy backends, each drawn uniformly among
+    /// the healthy ones, so that a backend down doesn't pass its share to
+    /// the next one.
+    fn two_choices<T: PartialOrd>(&self, load: impl Fn(usize) -> T) -> Option<usize> {
+        let healthy = (0..self.list.len()).filter(|&i| self.is_healthy(i));
+        let count = healthy.clone().count();
+        if count == 0 {
+            return None;
+        }
+        let a = random() as usize % count;
+        // Any other one, drawn among the others
+        let b = match count {
+            1 => a,
+            _ => {
+                let b = random() as usize % (count - 1);
+                b + (b >= a) as usize
+            }
+        };
+        // The health may change in between, any healthy one will do then
+        let nth = |n| healthy.clone().nth(n).or_else(|| self.healthy_from(n));
+        let (first, second) = (nth(a)?, nth(b)?);
+        match load(second) < load(first) {
+            true => Some(second),
+            false => Some(first),
+        }
+    }
+}
+
+thread_local! {
+    static STATE: Cell<u64> = Cell::new(RandomState::new().build_hasher().finish() | 1);
+}
+
+/// Hash of a key or of a point on the ring, the same in every worker.
+pub fn hash(key: impl Hash) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    key.hash(&mut hasher);
+    hasher.finish()
+}
+
+/// Fast per thread pseudo-random numbers, xorshift64*.
+fn random() -> u64 {
+    STATE.with(|state| {
+        let mut x = state.get();
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        state.set(x);
+        x.wrapping_mul(0x2545_f491_4f6c_dd1d)
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_pick() {
+        let names: Vec<_> = (1..=3).map(|port| format!("127.0.0.1:{port}")).collect();
+        let backends = Backends::resolve(&names, Policy::LeastRequests, 1, 1).unwrap();
+        for _ in 0..30 {
+            backends.pick(0);
+        }
+        assert_eq!(
+            (0..3).map(|i| backends.in_flight(i)).collect::<Vec<_>>(),
+            [10, 10, 10]
+        );
+        backends.release(1);
+        backends.release(1);
+        assert_eq!(backends.pick(0), Some(1));
+
+        // Down backends get no requests
+        let backends = Backends::resolve(&names, Policy::TwoChoices, 1, 1).unwrap();
+        backends.failure(0);
+        for _ in 0..30 {
+            assert_ne!(backends.pick(0), Some(0));
+        }
+        backends.failure(2);
+        assert_eq!(backends.pick(0), Some(1));
+    }
+
+    #[test]
+    fn test_round_robin() {
+        let names: Vec<_> = (1..=4).map(|port| format!("127.0.0.1:{port}")).collect();
+        let backends = Backends::resolve(&names, Policy::RoundRobin, 1, 1).unwrap();
+        backends.failure(1);
+        let mut counts = [0; 4];
+        for _ in 0..30 {
+            counts[backends.pick(0).unwrap()] += 1;
+        }
+        assert_eq!(counts, [10, 0, 10, 10]);
+    }
+
+    #[test]
+    fn test_two_choices() {
+        let names: Vec<_> = (1..=4).map(|port| format!("127.0.0.1:{port}")).collect();
+        let backends = Backends::resolve(&names, Policy::TwoChoices, 1, 1).unwrap();
+        backends.failure(1);
+        // With equal loads the first draw wins, it must be uniform
+        let mut counts = [0; 4];
+        for _ in 0..30_000 {
+            counts[backends.two_choices(|_| 0).unwrap()] += 1;
+        }
+        assert_eq!(counts[1], 0);
+        for i in [0, 2, 3] {
+            assert!((9_000..11_000).contains(&counts[i]), "{counts:?}");
+        }
+        // And the second one is another backend
+        for _ in 0..100 {
+            let picked = backends.two_choices(|i| i).unwrap();
+            assert!(picked == 0 || picked == 2, "{picked}");
+        }
+    }
+
+    #[test]
+    fn test_peak_ewma() {
+        let names: Vec<_> = (1..=2).map(|port| format!("127.0.0.1:{port}")).collect();
+        let backends = Backends::resolve(&names, Policy::PeakEwma, 1, 1).unwrap();
+        let ms = Duration::from_millis;
+        backends.latency(0, ms(1));
+        backends.latency(1, ms(10));
+        for _ in 0..5 {
+            assert_eq!(backends.pick(0), Some(0));
+        }
+        // A peak is taken at once, the way back down is slow
+        backends.latency(0, ms(50));
+        assert_eq!(backends.pick(0), Some(1));
+        backends.latency(0, ms(1));
+        assert!(backends.cost(0, backends.now()) > backends.cost(1, backends.now()));
+    }
+
+    #[test]
+    fn test_consistent_hash() {
+        let names: Vec<_> = (1..=3).map(|port| format!("127.0.0.1:{port}")).collect();
+        let policy = Policy::parse("consistent-hash").unwrap();
+        let backends = Backends::resolve(&names, policy, 1, 1).unwrap();
+        let pick = |key: &str| {
+            let picked = backends.pick(hash(key.as_bytes())).unwrap();
+            backends.release(picked);
+            picked
+        };
+        let keys: Vec<_> = (0..300).map(|k| format!("/{k}")).collect();
+        let picked: Vec<_> = keys.iter().map(|key| pick(key)).collect();
+        for i in 0..3 {
+            assert!(picked.iter().filter(|&&p| p == i).count() > 50);
+        }
+        assert!(keys.iter().zip(&picked).all(|(key, &p)| pick(key) == p));
+
+        // Only the keys of a backend down move
+        backends.failure(1);
+        for (key, &p) in keys.iter().zip(&picked) {
+            assert!(p == 1 || pick(key) == p);
+        }
+
+        // A key gets other backends once its own has more than its share
+        let mut counts = [0; 3];
+        for _ in 0..12 {
+            counts[backends.pick(hash(&b"/0"[..])).unwrap()] += 1;
+        }
+        assert_eq!(counts[1], 0);
+        counts.sort();
+        assert_eq!(counts, [0, 4, 8]);
+    }
+}
@@ -0,0 +1,142 @@
+use std::io::{Read, Write};
+use std::net::{SocketAddr, TcpStream};
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use crate::balance::Backends;
+use crate::http::parse_response;
+
+/// Longest wait for a probe to connect or get its response.
+const PROBE_TIMEOUT: Duration = Duration::from_secs(1);
+
+/// How backends are checked: a connection accepted, or a 2xx or 3xx
+/// response to a GET of the path.
+pub enum Probe {
+    Tcp,
+    Http(String),
+}
+
+/// Health of a backend, fed by the probes and by the requests it serves.
+///
+/// A backend leaves the rotation after `fall` consecutive failures, and
+/// comes back after `rise` consecutive successes, which only the probes
+/// bring once it is out. Races between threads recording at the same time
+/// only make a transition a check early or late.
+pub struct Health {
+    healthy: AtomicBool,
+    successes: AtomicU32,
+    failures: AtomicU32,
+}
+
+impl Health {
+    pub fn new() -> Self {
+        Health {
+            healthy: AtomicBool::new(true),
+            successes: AtomicU32::new(0),
+            failures: AtomicU32::new(0),
+        }
+    }
+
+    pub fn is_healthy(&self) -> bool {
+        self.healthy.load(Ordering::Relaxed)
+    }
+
+    /// Returns true if the backend is back in rotation.
+    pub fn success(&self, rise: u32) -> bool {
+        self.failures.store(0, Ordering::Relaxed);
+        if self.is_healthy() || self.successes.fetch_add(1, Ordering::Relaxed) + 1 < rise {
+            return false;
+        }
+        self.successes.store(0, Ordering::Relaxed);
+        !self.healthy.swap(true, Ordering::Relaxed)
+    }
+
+    /// Returns true if the backend is taken out of rotation.
+    pub fn failure(&self, fall: u32) -> bool {
+        self.successes.store(0, Ordering::Relaxed);
+        if !self.is_healthy() || self.failures.fetch_add(1, Ordering::Relaxed) + 1 < fall {
+            return false;
+        }
+        self.failures.store(0, Ordering::Relaxed);
+        self.healthy.swap(false, Ordering::Relaxed)
+    }
+}
+
+/// Probes every backend every `interval`, forever. Each backend has its
+/// own thread, so those timing out don't delay the checks of the others.
+pub fn check(backends: &Backends, probe: &Probe, interval: Duration) {
+    let timeout = interval.min(PROBE_TIMEOUT);
+    thread::scope(|s| {
+        for (i, backend) in backends.list.iter().enumerate() {
+            s.spawn(move || loop {
+                let start = Instant::now();
+                match run_probe(&backend.addr, &backend.name, probe, timeout) {
+                    true => backends.success(i),
+                    false => backends.failure(i),
+                }
+                thread::sleep(interval.saturating_sub(start.elapsed()));
+            });
+        }
+    });
+}
+
+fn run_probe(addr: &SocketAddr, host: &str, probe: &Probe, timeout: Duration) -> bool {
+    let Ok(mut stream) = TcpStream::connect_timeout(addr, timeout) else {
+        return false;
+    };
+    let Probe::Http(path) = probe else {
+        return true;
+    };
+
+    let _ = stream.set_read_timeout(Some(timeout));
+    let _ = stream.set_write_timeout(Some(timeout));
+    let request = format!("GET {path} HTTP/1.1\r\nHost: {host}\r\nConnection: close\r\n\r\n");
+    if stream.write_all(request.as_bytes()).is_err() {
+        return false;
+    }
+
+    // Only the status matters, the head is enough
+    let mut buf = [0; 4096];
+    let mut len = 0;
+    loop {
+        match stream.read(&mut buf[len..]) {
+            Ok(0) | Err(_) => return false,
+            Ok(n) => len += n,
+        }
+        match parse_response(&buf[..len], false) {
+            Ok(Some(head)) => return (200..400).contains(&head.status),
+            Ok(None) if len < buf.len() => (),
+            _ => return false,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Health;
+
+    #[test]
+    fn test_health() {
+        let health = Health::new();
+        assert!(health.is_healthy());
+
+        // Out after `fall` failures in a row, successes reset the count
+        assert!(!health.failure(3));
+        assert!(!health.failure(3));
+        assert!(!health.success(2));
+        assert!(!health.failure(3));
+        assert!(!health.failure(3));
+        assert!(health.failure(3));
+        assert!(!health.is_healthy());
+        assert!(!health.failure(3));
+
+        // Back after `rise` successes in a row
+        assert!(!health.success(2));
+        assert!(!health.failure(3));
+        assert!(!health.success(2));
+        assert!(health.success(2));
+        assert!(health.is_healthy());
+        assert!(!health.success(2));
+    }
+}
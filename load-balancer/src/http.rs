@@ -0,0 +1,567 @@
+use crate::Error;
+
+/// How the body of a message ends, and how much of it is left.
+#[derive(Debug, PartialEq)]
+pub enum Body {
+    Length(u64),
+    Chunked(Chunked),
+    Close,
+}
+
+/// Start line and headers of a message, borrowed from its buffer.
+#[derive(Debug, PartialEq)]
+pub struct Head<'a> {
+    pub len: usize,
+    pub body: Body,
+    /// The connection is to be closed after this message.
+    pub close: bool,
+    /// Status of a response, 0 for a request.
+    pub status: u16,
+    /// A HEAD request, whose response has no body whatever its headers.
+    pub head_request: bool,
+    /// A request which may be sent twice with the same effect as once.
+    pub idempotent: bool,
+    /// Target of a request, empty for a response.
+    pub target: &'a [u8],
+    pub host: Option<&'a [u8]>,
+}
+
+/// Headers which matter to relay a message.
+#[derive(Default)]
+struct Headers<'a> {
+    content_length: Option<u64>,
+    /// Last coding of the Transfer-Encoding header.
+    coding: Option<&'a [u8]>,
+    close: bool,
+    host: Option<&'a [u8]>,
+}
+
+fn invalid(what: &str) -> Error {
+    Error(format!("Invalid {what}"))
+}
+
+/// Position of the first byte from `from` which ends a line or isn't
+/// allowed in a head: the control characters but the tab.
+///
+/// Lines are scanned 16 bytes at a time with SSE2, which every x86_64 has.
+fn find_stop(buf: &[u8], from: usize) -> Option<usize> {
+    let mut i = from;
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        use std::arch::x86_64::*;
+
+        let below_space = _mm_set1_epi8(0x1f);
+        let tab = _mm_set1_epi8(b'\t' as i8);
+        let del = _mm_set1_epi8(0x7f);
+        while i + 16 <= buf.len() {
+            let chunk = _mm_loadu_si128(buf.as_ptr().add(i) as *const __m128i);
+            // Unsigned x <= 0x1f is min(x, 0x1f) == x
+            let control = _mm_cmpeq_epi8(_mm_min_epu8(chunk, below_space), chunk);
+            let control = _mm_andnot_si128(_mm_cmpeq_epi8(chunk, tab), control);
+            let stop = _mm_or_si128(control, _mm_cmpeq_epi8(chunk, del));
+            let mask = _mm_movemask_epi8(stop);
+            if mask != 0 {
+                return Some(i + mask.trailing_zeros() as usize);
+            }
+            i += 16;
+        }
+    }
+    buf[i..].iter().position(|&b| is_control(b)).map(|p| i + p)
+}
+
+/// Control characters but the tab, not allowed in a head nor in the lines
+/// of a chunked body.
+fn is_control(b: u8) -> bool {
+    (b < 0x20 && b != b'\t') || b == 0x7f
+}
+
+/// Next line of the head from `from`, without its end, and where the
+/// following one starts. None if the line isn't complete yet.
+fn next_line(buf: &[u8], from: usize) -> Result<Option<(&[u8], usize)>, Error> {
+    let Some(stop) = find_stop(buf, from) else {
+        return Ok(None);
+    };
+    match buf[stop] {
+        b'\n' => Ok(Some((&buf[from..stop], stop + 1))),
+        b'\r' => match buf.get(stop + 1) {
+            Some(b'\n') => Ok(Some((&buf[from..stop], stop + 2))),
+            Some(_) => Err(invalid("line ending")),
+            None => Ok(None),
+        },
+        _ => Err(invalid("character in head")),
+    }
+}
+
+fn trim(mut s: &[u8]) -> &[u8] {
+    while let [b' ' | b'\t', rest @ ..] = s {
+        s = rest;
+    }
+    while let [rest @ .., b' ' | b'\t'] = s {
+        s = rest;
+    }
+    s
+}
+
+/// True if the comma separated `list` has `token`, whatever its case.
+fn has_token(list: &[u8], token: &[u8]) -> bool {
+    list.split(|&b| b == b',')
+        .any(|t| trim(t).eq_ignore_ascii_case(token))
+}
+
+fn parse_u64(digits: &[u8]) -> Option<u64> {
+    if digits.is_empty() {
+        return None;
+    }
+    digits.iter().try_fold(0u64, |n, &d| {
+        d.is_ascii_digit()
+            .then(|| n.checked_mul(10)?.checked_add((d - b'0') as u64))?
+    })
+}
+
+fn is_version(s: &[u8]) -> bool {
+    s.eq_ignore_ascii_case(b"http/1.1")
+}
+
+/// Parses the header lines from `from`, up to the empty line ending them,
+/// returns them with the length of the head, once it is complete.
+///
+/// Nothing is allocated: the values kept are slices of `buf`, and names
+/// are only compared, without case, to the few which matter.
+fn parse_headers(buf: &[u8], from: usize) -> Result<Option<(Headers<'_>, usize)>, Error> {
+    let mut headers = Headers::default();
+    let mut pos = from;
+    loop {
+        let Some((line, next)) = next_line(buf, pos)? else {
+            return Ok(None);
+        };
+        pos = next;
+        if line.is_empty() {
+            return Ok(Some((headers, pos)));
+        }
+
+        let Some(colon) = line.iter().position(|&b| b == b':') else {
+            return Err(invalid("header"));
+        };
+        let (name, value) = (&line[..colon], trim(&line[colon + 1..]));
+        // No space is allowed before the colon, nor a folded line
+        if name.is_empty() || name.iter().any(|&b| b == b' ' || b == b'\t') {
+            return Err(invalid("header name"));
+        }
+        // Dispatch on the length first, it rules out most names at once
+        match name.len() {
+            4 if name.eq_ignore_ascii_case(b"host") => headers.host = Some(value),
+            10 if name.eq_ignore_ascii_case(b"connection") => {
+                headers.close |= has_token(value, b"close")
+            }
+            14 if name.eq_ignore_ascii_case(b"content-length") => {
+                let n = parse_u64(value).ok_or_else(|| invalid("content length"))?;
+                // Disagreeing lengths are how requests get smuggled
+                if headers.content_length.is_some_and(|m| m != n) {
+                    return Err(invalid("content length"));
+                }
+                headers.content_length = Some(n);
+            }
+            17 if name.eq_ignore_ascii_case(b"transfer-encoding") => {
+                let last = value.rsplit(|&b| b == b',').next().unwrap_or(value);
+                headers.coding = Some(trim(last));
+            }
+            _ => (),
+        }
+    }
+}
+
+impl Headers<'_> {
+    fn chunked(&self) -> bool {
+        self.coding
+            .is_some_and(|c| c.eq_ignore_ascii_case(b"chunked"))
+    }
+}
+
+/// Parses the head of the request at the start of `buf`, once complete.
+pub fn parse_request(buf: &[u8]) -> Result<Option<Head<'_>>, Error> {
+    let Some((line, next)) = next_line(buf, 0)? else {
+        return Ok(None);
+    };
+    let mut parts = line.splitn(3, |&b| b == b' ');
+    let (Some(method), Some(target), Some(version)) = (parts.next(), parts.next(), parts.next())
+    else {
+        return Err(invalid("request line"));
+    };
+    if !is_version(version) {
+        return Err(Error("This server only handle HTTP 1.1".to_string()));
+    }
+
+    let Some((headers, len)) = parse_headers(buf, next)? else {
+        return Ok(None);
+    };
+    let body = match headers {
+        // The backend may frame it by the other header: that's how requests
+        // get smuggled, RFC 9112 6.3
+        Headers {
+            coding: Some(_),
+            content_length: Some(_),
+            ..
+        } => return Err(invalid("content length with transfer encoding")),
+        _ if headers.chunked() => Body::Chunked(Chunked::default()),
+        // The length of the body can't be known
+        Headers {
+            coding: Some(_), ..
+        } => return Err(invalid("transfer encoding")),
+        Headers {
+            content_length: Some(n),
+            ..
+        } => Body::Length(n),
+        _ => Body::Length(0),
+    };
+    Ok(Some(Head {
+        len,
+        body,
+        close: headers.close,
+        status: 0,
+        head_request: method == b"HEAD",
+        // Methods idempotent by definition, RFC 9110 9.2.2
+        idempotent: matches!(
+            method,
+            b"GET" | b"HEAD" | b"OPTIONS" | b"PUT" | b"DELETE" | b"TRACE"
+        ),
+        target,
+        host: headers.host,
+    }))
+}
+
+/// Value of the first `name` header of the `len` bytes head at the start of
+/// `buf`, which was parsed already.
+pub fn header<'a>(buf: &'a [u8], len: usize, name: &[u8]) -> Option<&'a [u8]> {
+    buf[..len].split(|&b| b == b'\n').skip(1).find_map(|line| {
+        let line = line.strip_suffix(b"\r").unwrap_or(line);
+        let colon = line.iter().position(|&b| b == b':')?;
+        let found = line[..colon].eq_ignore_ascii_case(name);
+        found.then(|| trim(&line[colon + 1..]))
+    })
+}
+
+/// Parses the head of the response at the start of `buf`, once complete,
+/// `head_request` tells if it answers a HEAD request.
+pub fn parse_response(buf: &[u8], head_request: bool) -> Result<Option<Head<'_>>, Error> {
+    let Some((line, next)) = next_line(buf, 0)? else {
+        return Ok(None);
+    };
+    let mut parts = line.splitn(3, |&b| b == b' ');
+    let (Some(version), Some(status)) = (parts.next(), parts.next()) else {
+        return Err(invalid("status line"));
+    };
+    if !is_version(version) {
+        return Err(Error("This server only handle HTTP 1.1".to_string()));
+    }
+    let status = match status {
+        [b'1'..=b'9', b'0'..=b'9', b'0'..=b'9'] => parse_u64(status).unwrap() as u16,
+        _ => return Err(invalid("status")),
+    };
+
+    let Some((headers, len)) = parse_headers(buf, next)? else {
+        return Ok(None);
+    };
+    let body = match headers {
+        _ if head_request || status < 200 || status == 204 || status == 304 => Body::Length(0),
+        _ if headers.chunked() => Body::Chunked(Chunked::default()),
+        Headers {
+            coding: Some(_), ..
+        } => Body::Close,
+        Headers {
+            content_length: Some(n),
+            ..
+        } => Body::Length(n),
+        _ => Body::Close,
+    };
+    Ok(Some(Head {
+        len,
+        close: headers.close || body == Body::Close,
+        body,
+        status,
+        head_request,
+        idempotent: false,
+        target: b"",
+        host: None,
+    }))
+}
+
+impl Body {
+    /// Goes through the next bytes of the message, returns how many of
+    /// them belong to the body, and whether it ends there.
+    pub fn take(&mut self, buf: &[u8]) -> Result<(usize, bool), Error> {
+        match self {
+            Body::Length(left) => {
+                let n = buf.len().min(*left as usize);
+                *left -= n as u64;
+                Ok((n, *left == 0))
+            }
+            Body::Chunked(chunked) => chunked.take(buf),
+            // Only the end of the connection ends it
+            Body::Close => Ok((buf.len(), false)),
+        }
+    }
+
+    /// How many of the next bytes are data, that can be relayed without
+    /// being looked at.
+    pub fn opaque_len(&self) -> u64 {
+        match self {
+            Body::Length(left) => *left,
+            Body::Chunked(chunked) if chunked.state == ChunkState::Data => chunked.size,
+            Body::Chunked(_) => 0,
+            Body::Close => u64::MAX,
+        }
+    }
+
+    /// Skips `n` bytes of data relayed without being looked at, at most
+    /// `opaque_len`, returns whether the body ends there.
+    pub fn skip(&mut self, n: usize) -> bool {
+        match self {
+            Body::Length(left) => {
+                *left -= n as u64;
+                *left == 0
+            }
+            Body::Chunked(chunked) => {
+                chunked.size -= n as u64;
+                if chunked.size == 0 {
+                    chunked.state = ChunkState::DataCr;
+                }
+                false
+            }
+            Body::Close => false,
+        }
+    }
+}
+
+#[derive(Debug, Default, PartialEq)]
+enum ChunkState {
+    #[default]
+    Size,
+    SizeDigits,
+    /// Whitespace after the size, only allowed before an extension.
+    SizeWs,
+    Extension,
+    SizeLf,
+    Data,
+    DataCr,
+    DataLf,
+    TrailerStart,
+    Trailer,
+    TrailerLf,
+    EndLf,
+    Done,
+}
+
+/// Finds the end of a chunked body, without decoding it since it is
+/// relayed as is.
+///
+/// The framing is checked strictly, as the backend has to find the same
+/// end: the size must have a digit, lines must end with CRLF, and the
+/// extensions and trailers can't hold control characters.
+#[derive(Debug, Default, PartialEq)]
+pub struct Chunked {
+    state: ChunkState,
+    size: u64,
+}
+
+impl Chunked {
+    fn take(&mut self, buf: &[u8]) -> Result<(usize, bool), Error> {
+        let invalid = || Error("Invalid chunked body".to_string());
+
+        let mut i = 0;
+        while i < buf.len() && self.state != ChunkState::Done {
+            let b = buf[i];
+            self.state = match self.state {
+                ChunkState::Size | ChunkState::SizeDigits if b.is_ascii_hexdigit() => {
+                    let digit = (b as char).to_digit(16).unwrap() as u64;
+                    self.size = self
+                        .size
+                        .checked_mul(16)
+                        .and_then(|s| s.checked_add(digit))
+                        .ok_or_else(invalid)?;
+                    ChunkState::SizeDigits
+                }
+                ChunkState::Size => return Err(invalid()),
+                ChunkState::SizeDigits => match b {
+                    b';' => ChunkState::Extension,
+                    b' ' | b'\t' => ChunkState::SizeWs,
+                    b'\r' => ChunkState::SizeLf,
+                    _ => return Err(invalid()),
+                },
+                ChunkState::SizeWs => match b {
+                    b';' => ChunkState::Extension,
+                    b' ' | b'\t' => ChunkState::SizeWs,
+                    _ => return Err(invalid()),
+                },
+                ChunkState::Extension => match b {
+                    b'\r' => ChunkState::SizeLf,
+                    b if is_control(b) => return Err(invalid()),
+                    _ => ChunkState::Extension,
+                },
+                ChunkState::SizeLf => match b {
+                    b'\n' => self.after_size(),
+                    _ => return Err(invalid()),
+                },
+                ChunkState::Data => {
+                    // Skip the data at once
+                    let n = (buf.len() - i).min(self.size as usize);
+                    self.size -= n as u64;
+                    i += n;
+                    if self.size == 0 {
+                        self.state = ChunkState::DataCr;
+                    }
+                    continue;
+                }
+                ChunkState::DataCr => match b {
+                    b'\r' => ChunkState::DataLf,
+                    _ => return Err(invalid()),
+                },
+                ChunkState::DataLf => match b {
+                    b'\n' => ChunkState::Size,
+                    _ => return Err(invalid()),
+                },
+                ChunkState::TrailerStart => match b {
+                    b'\r' => ChunkState::EndLf,
+                    b if is_control(b) => return Err(invalid()),
+                    _ => ChunkState::Trailer,
+                },
+                ChunkState::Trailer => match b {
+                    b'\r' => ChunkState::TrailerLf,
+                    b if is_control(b) => return Err(invalid()),
+                    _ => ChunkState::Trailer,
+                },
+                ChunkState::TrailerLf | ChunkState::EndLf if b != b'\n' => return Err(invalid()),
+                ChunkState::TrailerLf => ChunkState::TrailerStart,
+                ChunkState::EndLf => ChunkState::Done,
+                ChunkState::Done => unreachable!(),
+            };
+            i += 1;
+        }
+        Ok((i, self.state == ChunkState::Done))
+    }
+
+    /// A chunk of size 0 is the last one, trailers follow.
+    fn after_size(&mut self) -> ChunkState {
+        match self.size {
+            0 => ChunkState::TrailerStart,
+            _ => ChunkState::Data,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{header, parse_request, parse_response, Body, Chunked};
+
+    #[test]
+    fn test_parse_head() {
+        let req = b"POST /a HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhello";
+        let head = parse_request(req).unwrap().unwrap();
+        assert_eq!(head.len, req.len() - 5);
+        assert_eq!(head.body, Body::Length(5));
+        assert!(!head.idempotent);
+        assert!(parse_request(&req[..20]).unwrap().is_none());
+
+        let res = b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+        let head = parse_response(res, false).unwrap().unwrap();
+        assert_eq!(head.body, Body::Chunked(Chunked::default()));
+        assert!(!head.close);
+
+        let res = b"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
+        assert!(parse_response(res, false).unwrap().unwrap().close);
+        let res = b"HTTP/1.1 304 Not Modified\r\n\r\n";
+        assert_eq!(
+            parse_response(res, false).unwrap().unwrap().body,
+            Body::Length(0)
+        );
+        assert!(parse_request(b"GET / HTTP/1.0\r\n\r\n").is_err());
+    }
+
+    #[test]
+    fn test_headers() {
+        let req = b"GET /some/long/path?q=1 HTTP/1.1\r\nhOsT: \t example.org \r\n\
+            X-Long-Header-Name: a value long enough to span a few blocks\r\n\
+            CONNECTION: keep-alive, Close\r\ncontent-length: 0\r\n\r\n";
+        let head = parse_request(req).unwrap().unwrap();
+        assert_eq!(head.len, req.len());
+        assert_eq!(head.target, b"/some/long/path?q=1");
+        assert_eq!(head.host, Some(&b"example.org"[..]));
+        assert!(head.close);
+        assert!(!head.head_request);
+        assert!(head.idempotent);
+        assert_eq!(
+            header(req, head.len, b"connection"),
+            Some(&b"keep-alive, Close"[..])
+        );
+        assert_eq!(header(req, head.len, b"x-long"), None);
+
+        // Complete only once the empty line is there
+        for end in 0..req.len() {
+            assert!(parse_request(&req[..end]).unwrap().is_none());
+        }
+
+        for invalid in [
+            &b"GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n"[..],
+            b"GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+            b"GET / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+            b"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n",
+            b"POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n",
+            b"GET / HTTP/1.1\r\nHost : x\r\n\r\n",
+            b"GET / HTTP/1.1\r\nHost: a\rb\r\n\r\n",
+            b"GET / HTTP/1.1\r\nX-Header-Long-Enough: a\0b\r\n\r\n",
+            b"GET / HTTP/1.1\r\nno colon\r\n\r\n",
+            b"GET /\r\n\r\n",
+        ] {
+            assert!(parse_request(invalid).is_err());
+        }
+
+        let res = b"HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\
+            Transfer-Encoding: gzip, chunked\r\n\r\n";
+        let head = parse_response(res, false).unwrap().unwrap();
+        assert_eq!(head.body, Body::Chunked(Chunked::default()));
+        let res = b"HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\n";
+        assert_eq!(
+            parse_response(res, true).unwrap().unwrap().body,
+            Body::Length(0)
+        );
+        assert!(parse_response(b"HTTP/1.1 20 OK\r\n\r\n", false).is_err());
+    }
+
+    #[test]
+    fn test_chunked() {
+        let body = b"5;ext=1\r\nhello\r\n10\r\n0123456789abcdef\r\n0\r\nTrailer: x\r\n\r\nNEXT";
+        let mut chunked = Body::Chunked(Chunked::default());
+        assert_eq!(chunked.take(body).unwrap(), (body.len() - 4, true));
+
+        // Fed a byte at a time
+        let mut chunked = Body::Chunked(Chunked::default());
+        for (i, b) in body[..body.len() - 4].iter().enumerate() {
+            let last = i == body.len() - 5;
+            assert_eq!(chunked.take(&[*b]).unwrap(), (1, last));
+        }
+        assert!(Body::Chunked(Chunked::default()).take(b"x\r\n").is_err());
+        assert!(Body::Chunked(Chunked::default()).take(b"2\r\nabc").is_err());
+
+        let body = b"5 ; a=\"b\"\t\r\nhello\r\n0\r\n\r\n";
+        let mut chunked = Body::Chunked(Chunked::default());
+        assert_eq!(chunked.take(body).unwrap(), (body.len(), true));
+
+        // Read differently by a backend, the proxy must not pick an end
+        for invalid in [
+            &b"\r\n"[..],
+            b";ext\r\n\r\n",
+            b" \r\n\r\n",
+            b"5 \r\nhello\r\n",
+            b"0\n\r\n",
+            b"5\r\nhello\n0\r\n\r\n",
+            b"0;ext\n\r\n",
+            b"0;a\0b\r\n\r\n",
+            b"0;a\rb\r\n\r\n",
+            b"0\r\nTrailer: x\n\r\n",
+            b"0\r\nTrailer: \x7f\r\n\r\n",
+            b"0\r\n\n",
+        ] {
+            let mut chunked = Body::Chunked(Chunked::default());
+            assert!(chunked.take(invalid).is_err(), "{invalid:?}");
+        }
+    }
+}
@@ -1,10 +1,16 @@
-use std::io::Read;
-use std::io::Write;
-use std::{
-    io::{BufRead, BufReader},
-    net::{TcpListener, TcpStream},
-    thread,
-};
+use std::io::{ErrorKind, Read, Write};
+use std::net::{IpAddr, TcpListener, TcpStream};
+use std::os::unix::io::AsRawFd;
+use std::process::exit;
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use args::Args;
+use balance::{Backends, Key};
+use http::{header, parse_request, parse_response, Body, Head};
+use pool::Pool;
+use sys::{Epoll, Pipe, EPOLLET, EPOLLEXCLUSIVE, EPOLLIN, EPOLLOUT, EPOLLRDHUP, PIPE_SIZE};
 
 #[derive(Debug)]
 struct Error(String);
@@ -15,86 +21,772 @@ macro_rules! error {
     };
 }
 
-macro_rules! debug {
-    ($s:expr) => {
-        println!("DEBUG: {}", $s)
+/// Reports an event worth knowing while running, on stderr so that it
+/// isn't mixed with the output of the process.
+macro_rules! log {
+    ($($arg:tt)*) => {
+        eprintln!("load-balancer: {}", format_args!($($arg)*))
     };
 }
 
-fn read_http_request(reader: &mut impl Read) -> Result<String, Error> {
-    let mut reader = BufReader::new(reader);
-    let mut req = String::new();
-    let mut buf = String::new();
+mod args;
+mod balance;
+mod health;
+mod http;
+mod pool;
+mod sys;
+
+/// Token of the listening socket, connections use their index.
+const LISTENER: u64 = u64::MAX;
+const MAX_EVENTS: usize = 1024;
+/// Size of the reads, which bounds what a message holds in memory at once.
+const READ_SIZE: usize = 16 * 1024;
+/// Largest start line and headers accepted.
+const MAX_HEAD: usize = 16 * 1024;
+/// Most buffers kept by a worker for the next requests.
+const MAX_SPARE_BUFFERS: usize = 1024;
+/// Most pipes kept by a worker for the next bodies to splice.
+const MAX_SPARE_PIPES: usize = 64;
+/// Client connections without activity for this long are closed.
+const CLIENT_IDLE_TIMEOUT: Duration = Duration::from_secs(60);
+/// Longest wait for events, so that timeouts are checked.
+const TICK: Duration = Duration::from_secs(1);
+
+const BAD_REQUEST: &[u8] =
+    b"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const BAD_GATEWAY: &[u8] =
+    b"HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const SERVICE_UNAVAILABLE: &[u8] =
+    b"HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const GATEWAY_TIMEOUT: &[u8] =
+    b"HTTP/1.1 504 Gateway Timeout\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+/// What the connections of a worker share.
+struct Worker {
+    epoll: Epoll,
+    backends: Arc<Backends>,
+    pool: Pool,
+    scratch: Vec<u8>,
+    spare: Vec<Vec<u8>>,
+    pipes: Vec<Pipe>,
+}
+
+impl Worker {
+    /// An empty buffer for a message.
+    fn buffer(&mut self) -> Vec<u8> {
+        self.spare
+            .pop()
+            .unwrap_or_else(|| Vec::with_capacity(MAX_HEAD + READ_SIZE))
+    }
+
+    /// Takes back the buffer of a connection going idle, for another one.
+    fn recycle(&mut self, buf: &mut Vec<u8>) {
+        let buf = std::mem::take(buf);
+        if self.spare.len() < MAX_SPARE_BUFFERS && buf.capacity() <= MAX_HEAD + READ_SIZE {
+            self.spare.push(buf);
+        }
+    }
+
+    /// An empty pipe to splice a body, unless out of descriptors.
+    fn pipe(&mut self) -> Option<Pipe> {
+        self.pipes.pop().or_else(|| Pipe::new().ok())
+    }
+
+    /// Takes back the empty pipe of a relayed body.
+    fn recycle_pipe(&mut self, pipe: Pipe) {
+        if self.pipes.len() < MAX_SPARE_PIPES {
+            self.pipes.push(pipe);
+        }
+    }
+
+    /// A connection to `backend` whose events are reported with `token`,
+    /// and whether it was reused.
+    fn connect(&mut self, backend: usize, token: u64) -> Result<(TcpStream, bool), Error> {
+        let events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        if let Some(stream) = self.pool.checkout(backend) {
+            // Still watched since its previous request, only the token changes
+            self.epoll
+                .modify(stream.as_raw_fd(), events, token)
+                .map_err(|e| error!(e))?;
+            return Ok((stream, true));
+        }
+        Ok((self.open(backend, token)?, false))
+    }
+
+    /// A new connection to `backend`.
+    fn open(&mut self, backend: usize, token: u64) -> Result<TcpStream, Error> {
+        let events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        let stream =
+            sys::connect_nonblocking(&self.backends.list[backend].addr).map_err(|e| error!(e))?;
+        self.epoll
+            .add(stream.as_raw_fd(), events, token)
+            .map_err(|e| error!(e))?;
+        Ok(stream)
+    }
+}
 
-    // Parse first line
-    reader.read_line(&mut buf).map_err(|e| error!(e.kind()))?;
+/// A message being relayed from one socket to the other through a buffer,
+/// which only holds a part of its body at a time.
+struct Relay {
+    body: Body,
+    /// End of the bytes of the message in the buffer.
+    pending: usize,
+    /// How many of them were written.
+    sent: usize,
+    /// The buffer holds the end of the message.
+    done: bool,
+    /// The start of the message was dropped from the buffer.
+    drained: bool,
+    /// Pipe through which large bodies are spliced, and how many bytes it
+    /// holds.
+    pipe: Option<Pipe>,
+    piped: usize,
+    /// Splicing failed, only the buffer is used.
+    no_splice: bool,
+    /// The last error came from `src`, not `dst`.
+    src_failed: bool,
+}
 
-    if !buf.to_lowercase().contains("http/1.1") {
-        return Err(error!("This server only handle HTTP 1.1"));
+impl Relay {
+    /// Starts relaying the message whose `head` bytes start `buf`.
+    fn new(head: usize, mut body: Body, buf: &[u8]) -> Result<Self, Error> {
+        let (n, done) = body.take(&buf[head..])?;
+        Ok(Relay {
+            body,
+            pending: head + n,
+            sent: 0,
+            done,
+            drained: false,
+            pipe: None,
+            piped: 0,
+            no_splice: false,
+            src_failed: false,
+        })
     }
-    req.push_str(&buf);
-    buf.clear();
 
-    // Parse Header
-    let mut content_len = None;
-    while let Ok(_) = reader.read_line(&mut buf) {
-        let keyword = "content-length:";
-        if buf.to_lowercase().trim().starts_with(keyword) {
-            content_len = Some(
-                buf[keyword.len()..]
-                    .trim()
-                    .parse::<usize>()
-                    .map_err(|e| error!(e.kind()))?,
-            )
+    /// Relays again the `len` bytes message at the start of the buffer.
+    fn replay(len: usize) -> Self {
+        Relay {
+            body: Body::Length(0),
+            pending: len,
+            sent: 0,
+            done: true,
+            drained: false,
+            pipe: None,
+            piped: 0,
+            no_splice: false,
+            src_failed: false,
         }
+    }
 
-        // If we encounter an empty line, we've reached the end of the headers
-        if buf == "\r\n" || buf == "\n" {
-            req.push_str("\r\n");
-            break;
+    /// Writes the message to `dst`, reading the rest of it from `src`,
+    /// returns false if it would block, true once it is all written.
+    ///
+    /// Bodies larger than a read are spliced from socket to socket through
+    /// a pipe, when the data isn't to be looked at: all of it if its length
+    /// is known or if it ends with the connection, the data of the chunks
+    /// for chunked ones.
+    fn run(
+        &mut self,
+        src: &mut TcpStream,
+        dst: &mut TcpStream,
+        buf: &mut Vec<u8>,
+        worker: &mut Worker,
+    ) -> Result<bool, Error> {
+        loop {
+            if self.sent < self.pending {
+                if !flush(dst, &buf[..self.pending], &mut self.sent)? {
+                    return Ok(false);
+                }
+            } else if self.piped > 0 {
+                let pipe = self.pipe.as_ref().unwrap();
+                match pipe.drain_to(dst, self.piped) {
+                    Ok(n) => self.piped -= n,
+                    Err(e) if e.kind() == ErrorKind::WouldBlock => return Ok(false),
+                    Err(e) if e.kind() == ErrorKind::Interrupted => (),
+                    Err(e) => return Err(error!(e.kind())),
+                }
+            } else if self.done {
+                if let Some(pipe) = self.pipe.take() {
+                    worker.recycle_pipe(pipe);
+                }
+                return Ok(true);
+            } else {
+                match self.read(src, buf, worker) {
+                    Ok(true) => (),
+                    Ok(false) => return Ok(false),
+                    Err(e) => {
+                        self.src_failed = true;
+                        return Err(e);
+                    }
+                }
+            }
         }
+    }
 
-        req.push_str(&buf);
+    /// Reads the next part of the message once the previous one is written,
+    /// returns false if it would block.
+    fn read(
+        &mut self,
+        src: &mut TcpStream,
+        buf: &mut Vec<u8>,
+        worker: &mut Worker,
+    ) -> Result<bool, Error> {
+        // Everything read so far is written, make room for the rest
+        self.drained |= self.sent > 0;
         buf.clear();
+        self.sent = 0;
+        self.pending = 0;
+
+        let opaque = self.body.opaque_len();
+        if opaque > READ_SIZE as u64 && !self.no_splice {
+            if self.pipe.is_none() {
+                self.pipe = worker.pipe();
+            }
+            if let Some(pipe) = &self.pipe {
+                let len = opaque.min(PIPE_SIZE as u64) as usize;
+                match pipe.fill_from(src, len) {
+                    Ok(0) if self.body == Body::Close => self.done = true,
+                    Ok(0) => return Err(error!("Connection closed")),
+                    Ok(n) => {
+                        self.piped = n;
+                        self.done = self.body.skip(n);
+                        self.drained = true;
+                    }
+                    Err(e) if e.kind() == ErrorKind::WouldBlock => return Ok(false),
+                    Err(e) if e.kind() == ErrorKind::Interrupted => (),
+                    // Not spliceable, the buffer will do
+                    Err(e) if e.kind() == ErrorKind::InvalidInput => {
+                        self.no_splice = true;
+                        self.pipe = None;
+                    }
+                    Err(e) => return Err(error!(e.kind())),
+                }
+                return Ok(true);
+            }
+        }
+
+        match src.read(&mut worker.scratch) {
+            Ok(0) if self.body == Body::Close => self.done = true,
+            Ok(0) => return Err(error!("Connection closed")),
+            Ok(n) => {
+                buf.extend_from_slice(&worker.scratch[..n]);
+                (self.pending, self.done) = self.body.take(buf)?;
+            }
+            Err(e) if e.kind() == ErrorKind::WouldBlock => return Ok(false),
+            Err(e) if e.kind() == ErrorKind::Interrupted => (),
+            Err(e) => return Err(error!(e.kind())),
+        }
+        Ok(true)
     }
+}
 
-    // Parse optional content
-    if let Some(len) = content_len {
-        let mut buf = vec![0u8; len];
-        reader
-            .read_exact(&mut buf)
-            .map_err(|e| error!(format!("Invalid header : {}", e.kind())))?;
+enum State {
+    Request,
+    SendRequest(Relay),
+    /// Waiting for the response, the request is still `request_len` bytes
+    /// at the start of the buffer, and can be sent again if `replay`.
+    Response {
+        request_len: usize,
+        replay: bool,
+    },
+    /// Relaying the response, which is a 1xx one if `interim`.
+    SendResponse {
+        relay: Relay,
+        interim: bool,
+    },
+}
+
+/// A client connection, with the backend connection serving its current
+/// request.
+///
+/// Both sockets are non-blocking and edge-triggered: on any event, the
+/// connection goes as far as it can until a socket would block. Requests
+/// are served one after the other, the bytes of those pipelined by the
+/// client wait in `request` after the current one.
+///
+/// Messages are streamed: their bodies go through the buffers a read at a
+/// time, which are only held while a request is in flight.
+struct Conn {
+    client: TcpStream,
+    peer: IpAddr,
+    backend: Option<(usize, TcpStream)>,
+    reused: bool,
+    /// The request was sent to another backend after a failed connection.
+    retried: bool,
+    state: State,
+    request: Vec<u8>,
+    response: Vec<u8>,
+    head_request: bool,
+    /// The request in flight can be sent again.
+    idempotent: bool,
+    /// The client connection is to be closed after the response.
+    close: bool,
+    last_active: Instant,
+    /// When the request in flight was given a backend.
+    sent_at: Instant,
+    /// Consistent hash of the request in flight.
+    hash: u64,
+}
 
-        req.push_str(&String::from_utf8(buf).map_err(|_| error!("Body is not valid utf8"))?);
+/// Reads what is available from `stream` at the end of `buf`, returns false
+/// if it would block.
+fn fill(stream: &mut TcpStream, buf: &mut Vec<u8>, scratch: &mut [u8]) -> Result<bool, Error> {
+    match stream.read(scratch) {
+        Ok(0) => Err(error!("Connection closed")),
+        Ok(n) => {
+            buf.extend_from_slice(&scratch[..n]);
+            Ok(true)
+        }
+        Err(e) if e.kind() == ErrorKind::WouldBlock => Ok(false),
+        Err(e) if e.kind() == ErrorKind::Interrupted => Ok(true),
+        Err(e) => Err(error!(e.kind())),
     }
+}
 
-    Ok(req)
+/// Writes what it can of `buf[*written..]`, returns false if it would block.
+fn flush(stream: &mut TcpStream, buf: &[u8], written: &mut usize) -> Result<bool, Error> {
+    match stream.write(&buf[*written..]) {
+        Ok(n) => {
+            *written += n;
+            Ok(true)
+        }
+        Err(e) if e.kind() == ErrorKind::WouldBlock => Ok(false),
+        Err(e) if e.kind() == ErrorKind::Interrupted => Ok(true),
+        Err(e) => Err(error!(e.kind())),
+    }
 }
 
-fn handle_conn(mut conn: TcpStream, server: &str) {
-    let mut serv = TcpStream::connect(server).unwrap();
+impl Conn {
+    fn new(client: TcpStream, peer: IpAddr) -> Self {
+        Conn {
+            client,
+            peer,
+            backend: None,
+            reused: false,
+            retried: false,
+            state: State::Request,
+            request: Vec::new(),
+            response: Vec::new(),
+            head_request: false,
+            idempotent: false,
+            close: false,
+            last_active: Instant::now(),
+            sent_at: Instant::now(),
+            hash: 0,
+        }
+    }
 
-    let req = read_http_request(&mut conn).unwrap();
+    /// Makes progress until blocked, returns true once the connection is
+    /// to be closed.
+    fn advance(&mut self, worker: &mut Worker, token: u64) -> Result<bool, Error> {
+        self.last_active = Instant::now();
+        loop {
+            match self.step(worker, token) {
+                Ok(Some(done)) => return Ok(done),
+                Ok(None) => (),
+                // The backend may have closed a pooled connection just as it
+                // was reused, the request is sent again on a new one
+                Err(_) if self.reused && self.response.is_empty() && self.replayable() => {
+                    let (backend, _) = self.backend.as_ref().unwrap();
+                    let backend = *backend;
+                    let stream = worker.open(backend, token)?;
+                    self.reused = false;
+                    self.backend = Some((backend, stream));
+                    self.state = match std::mem::replace(&mut self.state, State::Request) {
+                        State::SendRequest(mut relay) => {
+                            relay.sent = 0;
+                            State::SendRequest(relay)
+                        }
+                        State::Response { request_len, .. } => {
+                            State::SendRequest(Relay::replay(request_len))
+                        }
+                        _ => unreachable!(),
+                    };
+                }
+                // Nothing reached a backend which refused the connection, the
+                // request goes to another one, once
+                Err(_) if !self.retried && self.unconnected() => {
+                    let (backend, _) = self.backend.take().unwrap();
+                    worker.backends.failure(backend);
+                    worker.backends.release(backend);
+                    self.retried = true;
+                    let Some(backend) = worker.backends.pick(self.hash) else {
+                        self.reply(SERVICE_UNAVAILABLE);
+                        return Ok(true);
+                    };
+                    let stream = worker
+                        .open(backend, token)
+                        .inspect_err(|_| worker.backends.release(backend))?;
+                    self.backend = Some((backend, stream));
+                }
+                Err(e) => {
+                    if let Some(backend) = self.backend_fault() {
+                        worker.backends.failure(backend);
+                    }
+                    // Unless the response started already, the client gets
+                    // told what went wrong
+                    match self.state {
+                        State::Request if !self.request.is_empty() => self.reply(BAD_REQUEST),
+                        State::SendRequest(_) | State::Response { .. } => self.reply(BAD_GATEWAY),
+                        _ => (),
+                    }
+                    return Err(e);
+                }
+            }
+        }
+    }
+
+    /// Hash of the `key` of the request with `head`, for it to go where
+    /// those with the same key went.
+    fn affinity(&self, key: &Key, head: &Head) -> u64 {
+        match key {
+            Key::Path => balance::hash(head.target.split(|&b| b == b'?').next()),
+            Key::Header(name) => balance::hash(header(&self.request, head.len, name.as_bytes())),
+            Key::ClientIp => balance::hash(self.peer),
+        }
+    }
+
+    /// True if a new backend connection failed before anything was sent.
+    fn unconnected(&self) -> bool {
+        match &self.state {
+            State::SendRequest(relay) => {
+                !self.reused && !relay.src_failed && !relay.drained && relay.sent == 0
+            }
+            _ => false,
+        }
+    }
+
+    /// Backend responsible for the failure of the request in flight, if any.
+    fn backend_fault(&self) -> Option<usize> {
+        let (backend, _) = self.backend.as_ref()?;
+        let fault = match &self.state {
+            State::Request => false,
+            State::SendRequest(relay) => !relay.src_failed,
+            State::Response { .. } => true,
+            State::SendResponse { relay, .. } => relay.src_failed,
+        };
+        fault.then_some(*backend)
+    }
+
+    /// Ends the request in flight, if any, before the connection is closed.
+    fn release(&mut self, worker: &Worker) {
+        if let Some((backend, _)) = self.backend.take() {
+            worker.backends.release(backend);
+        }
+    }
+
+    /// Ends the connection after no activity for too long. When it is the
+    /// backend which didn't connect or respond, it counts as a failure.
+    fn time_out(&mut self, worker: &Worker) {
+        let stalled = match &self.state {
+            State::SendRequest(relay) => relay.sent == 0 && !relay.drained,
+            State::Response { .. } => true,
+            _ => false,
+        };
+        if let (true, Some((backend, _))) = (stalled, &self.backend) {
+            worker.backends.failure(*backend);
+            self.reply(GATEWAY_TIMEOUT);
+        }
+    }
 
-    write!(serv, "{}", req).unwrap();
+    /// Sends a response of the balancer itself, the connection is then to be
+    /// closed. It is small enough not to block.
+    fn reply(&mut self, response: &[u8]) {
+        let _ = self.client.write(response);
+    }
+
+    /// True if the whole request is still in the buffer, and sending it
+    /// again is safe: the backend may have processed it before failing.
+    /// Other requests get a 502 rather than being submitted twice.
+    fn replayable(&self) -> bool {
+        if !self.idempotent {
+            return false;
+        }
+        match &self.state {
+            State::SendRequest(relay) => !relay.drained,
+            State::Response { replay, .. } => *replay,
+            _ => false,
+        }
+    }
 
-    let req = read_http_request(&mut serv).unwrap();
+    /// Does one read or write, returns whether the connection is to be
+    /// closed once it is or blocked.
+    fn step(&mut self, worker: &mut Worker, token: u64) -> Result<Option<bool>, Error> {
+        match &mut self.state {
+            State::Request => {
+                if self.request.capacity() == 0 {
+                    self.request = worker.buffer();
+                }
+                // A pipelined request may already be there
+                let Some(head) = parse_request(&self.request)? else {
+                    if self.request.len() >= MAX_HEAD {
+                        return Err(error!("Request head too large"));
+                    }
+                    return match fill(&mut self.client, &mut self.request, &mut worker.scratch) {
+                        Ok(true) => Ok(None),
+                        Ok(false) => {
+                            if self.request.is_empty() {
+                                worker.recycle(&mut self.request);
+                            }
+                            Ok(Some(false))
+                        }
+                        // Closing between requests is how clients leave
+                        Err(_) if self.request.is_empty() => Ok(Some(true)),
+                        Err(e) => Err(e),
+                    };
+                };
+                self.head_request = head.head_request;
+                self.idempotent = head.idempotent;
+                self.close = head.close;
+                self.hash = match worker.backends.hash_key() {
+                    Some(key) => self.affinity(key, &head),
+                    None => 0,
+                };
+                let relay = Relay::new(head.len, head.body, &self.request)?;
+                let Some(backend) = worker.backends.pick(self.hash) else {
+                    self.reply(SERVICE_UNAVAILABLE);
+                    return Ok(Some(true));
+                };
+                let (stream, reused) = match worker.connect(backend, token) {
+                    Ok(connected) => connected,
+                    Err(e) => {
+                        worker.backends.failure(backend);
+                        worker.backends.release(backend);
+                        self.reply(BAD_GATEWAY);
+                        return Err(e);
+                    }
+                };
+                self.backend = Some((backend, stream));
+                self.reused = reused;
+                self.retried = false;
+                self.sent_at = Instant::now();
+                self.state = State::SendRequest(relay);
+            }
+            State::SendRequest(relay) => {
+                let (_, backend) = self.backend.as_mut().unwrap();
+                if !relay.run(&mut self.client, backend, &mut self.request, worker)? {
+                    return Ok(Some(false));
+                }
+                // Kept until the response comes, to be sent again if need be
+                self.state = State::Response {
+                    request_len: relay.pending,
+                    replay: !relay.drained,
+                };
+            }
+            State::Response {
+                request_len,
+                replay,
+            } => {
+                if self.response.capacity() == 0 {
+                    self.response = worker.buffer();
+                }
+                let Some(head) = parse_response(&self.response, self.head_request)? else {
+                    if self.response.len() >= MAX_HEAD {
+                        return Err(error!("Response head too large"));
+                    }
+                    let (_, backend) = self.backend.as_mut().unwrap();
+                    if !fill(backend, &mut self.response, &mut worker.scratch)? {
+                        return Ok(Some(false));
+                    }
+                    return Ok(None);
+                };
+                let (backend, _) = self.backend.as_ref().unwrap();
+                worker.backends.success(*backend);
+                // Up to the first response head, a final one after an
+                // interim response would include the time to send the body
+                if *request_len > 0 {
+                    worker.backends.latency(*backend, self.sent_at.elapsed());
+                }
+                self.request.drain(..*request_len);
+                *request_len = 0;
+                *replay = false;
+                self.close |= head.close;
+                self.state = State::SendResponse {
+                    interim: head.status < 200,
+                    relay: Relay::new(head.len, head.body, &self.response)?,
+                };
+            }
+            State::SendResponse { relay, interim } => {
+                let (_, backend) = self.backend.as_mut().unwrap();
+                if !relay.run(backend, &mut self.client, &mut self.response, worker)? {
+                    return Ok(Some(false));
+                }
+                self.response.drain(..relay.pending);
+                if *interim {
+                    // The final response follows
+                    self.state = State::Response {
+                        request_len: 0,
+                        replay: false,
+                    };
+                    return Ok(None);
+                }
 
-    write!(conn, "{}", req).unwrap();
+                // Anything after the response leaves the backend connection
+                // in an unknown state
+                let (i, backend) = self.backend.take().unwrap();
+                worker.backends.release(i);
+                if !self.close && self.response.is_empty() {
+                    worker.pool.checkin(i, backend);
+                }
+                if self.close {
+                    return Ok(Some(true));
+                }
+                self.response.clear();
+                worker.recycle(&mut self.response);
+                if self.request.is_empty() {
+                    worker.recycle(&mut self.request);
+                }
+                self.state = State::Request;
+            }
+        }
+        Ok(None)
+    }
+}
+
+/// Serves the connections accepted by this thread until an epoll failure.
+///
+/// Each worker has its own epoll instance, connections and pool, and only
+/// shares the listening socket, which wakes a single worker per connection.
+fn run(listener: TcpListener, backends: Arc<Backends>) -> std::io::Result<()> {
+    let epoll = Epoll::new()?;
+    epoll.add(listener.as_raw_fd(), EPOLLIN | EPOLLEXCLUSIVE, LISTENER)?;
+    let mut worker = Worker {
+        epoll,
+        pool: Pool::new(backends.list.len()),
+        backends,
+        scratch: vec![0; READ_SIZE],
+        spare: Vec::new(),
+        pipes: Vec::new(),
+    };
+
+    let mut conns: Vec<Option<Conn>> = Vec::new();
+    let mut free = Vec::new();
+    let mut events = Vec::with_capacity(MAX_EVENTS);
+    let mut last_expiry = Instant::now();
+
+    loop {
+        worker.epoll.wait(&mut events, TICK.as_millis() as i32)?;
+        if last_expiry.elapsed() >= TICK {
+            worker.pool.expire();
+            for (id, slot) in conns.iter_mut().enumerate() {
+                let idle = slot.as_ref().map(|conn| conn.last_active.elapsed());
+                if idle >= Some(CLIENT_IDLE_TIMEOUT) {
+                    let mut conn = slot.take().unwrap();
+                    conn.time_out(&worker);
+                    conn.release(&worker);
+                    free.push(id);
+                }
+            }
+            last_expiry = Instant::now();
+        }
+
+        for event in &events {
+            let token = event.token();
+            if token == LISTENER {
+                while let Ok((client, peer)) = listener.accept() {
+                    if let Err(e) = client.set_nonblocking(true) {
+                        log!("can't accept a connection: {e}");
+                        continue;
+                    }
+                    let _ = client.set_nodelay(true);
+                    let id = free.pop().unwrap_or_else(|| {
+                        conns.push(None);
+                        conns.len() - 1
+                    });
+                    let events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    match worker.epoll.add(client.as_raw_fd(), events, id as u64) {
+                        Ok(()) => conns[id] = Some(Conn::new(client, peer.ip())),
+                        Err(e) => {
+                            log!("can't accept a connection: {e}");
+                            free.push(id);
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // Pooled connections keep the token of their last request, the
+            // events they get are spurious, or closed ones, which are then
+            // dropped when checked out.
+            let id = token as usize;
+            let Some(conn) = &mut conns[id] else {
+                continue; // Closed earlier in this batch
+            };
+            // Failed connections were answered if they could be, and most
+            // are only closed by the peer, nothing is worth logging
+            if let Ok(false) = conn.advance(&mut worker, token) {
+                continue;
+            }
+            // Closing the sockets also removes them from epoll
+            conn.release(&worker);
+            conns[id] = None;
+            free.push(id);
+        }
+    }
+}
+
+fn usage() {
+    eprintln!("Usage: load-balancer [OPTIONS] [backend...]");
+    eprintln!(
+        "Backends are host:port, default to localhost:8080, localhost:8081 and localhost:8082."
+    );
+    eprintln!("OPTIONS : ");
+    eprintln!("\t--listen <addr>          : Address to listen on. Default to 127.0.0.1:5050.");
+    eprintln!("\t--policy <policy>        : How backends are picked: round-robin (default),");
+    eprintln!("\t                           least-requests, two-choices, the least loaded of two");
+    eprintln!("\t                           random ones, or peak-ewma, the fastest of two random");
+    eprintln!("\t                           ones from their latency and load, or consistent-hash.");
+    eprintln!("\t--hash-key <key>         : What consistent hashing keeps requests to the same");
+    eprintln!("\t                           backend on: path (default), ip, or header:<name>.");
+    eprintln!("\t--hash-bound <epsilon>   : Backends get other keys above 1 + epsilon times the");
+    eprintln!("\t                           average load. Default to 0.25.");
+    eprintln!("\t--health-path <path>     : Check backends with a GET of path, which must answer");
+    eprintln!(
+        "\t                           2xx or 3xx. Default to checking they accept connections."
+    );
+    eprintln!("\t--health-interval <secs> : Time between two checks of a backend. Default to 2.");
+    eprintln!("\t--fall <n>               : Failures, of checks or requests, in a row taking a");
+    eprintln!("\t                           backend out of rotation. Default to 3.");
+    eprintln!(
+        "\t--rise <n>               : Successful checks in a row putting it back. Default to 2."
+    );
 }
 
 fn main() -> std::io::Result<()> {
-    let listener = TcpListener::bind("127.0.0.1:5050")?;
+    let args = match Args::build() {
+        Ok(args) => args,
+        Err(e) => {
+            eprintln!("{}", e.0);
+            usage();
+            exit(1);
+        }
+    };
+
+    let listener = TcpListener::bind(&args.listen)?;
+    listener.set_nonblocking(true)?;
+
+    let backends = Arc::new(Backends::resolve(
+        &args.backends,
+        args.policy,
+        args.rise,
+        args.fall,
+    )?);
+
+    let checked = backends.clone();
+    thread::spawn(move || health::check(&checked, &args.probe, args.interval));
 
-    let mut round_robin = ["localhost:8080", "localhost:8081", "localhost:8082"]
-        .iter()
-        .cycle();
+    let workers = thread::available_parallelism().map_or(1, |n| n.get());
+    let handles: Vec<_> = (0..workers)
+        .map(|_| {
+            let listener = listener.try_clone()?;
+            let backends = backends.clone();
+            Ok(thread::spawn(move || run(listener, backends)))
+        })
+        .collect::<std::io::Result<_>>()?;
 
-    for conn in listener.incoming() {
-        let server = *round_robin.next().unwrap();
-        let _thread_handle = thread::spawn(move || {
-            handle_conn(conn.unwrap(), server);
-        });
+    for handle in handles {
+        handle.join().unwrap()?;
     }
 
     Ok(())
@@ -0,0 +1,59 @@
+use std::io::ErrorKind;
+use std::net::TcpStream;
+use std::time::{Duration, Instant};
+
+/// Most idle connections kept per backend, by each worker.
+const MAX_IDLE: usize = 32;
+/// Idle connections older than this are closed, before the backend does.
+const IDLE_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// Idle keep-alive connections to the backends, owned by a single worker.
+///
+/// Each backend has a stack of connections: the most recently used one is
+/// reused first, and the oldest ones are those which time out or get
+/// dropped when the stack is full.
+pub struct Pool {
+    idle: Vec<Vec<(TcpStream, Instant)>>,
+}
+
+impl Pool {
+    pub fn new(backends: usize) -> Self {
+        Pool {
+            idle: (0..backends).map(|_| Vec::new()).collect(),
+        }
+    }
+
+    /// Takes an idle connection to `backend`, if one is still usable.
+    pub fn checkout(&mut self, backend: usize) -> Option<TcpStream> {
+        let idle = &mut self.idle[backend];
+        while let Some((stream, since)) = idle.pop() {
+            if since.elapsed() < IDLE_TIMEOUT && is_idle(&stream) {
+                return Some(stream);
+            }
+        }
+        None
+    }
+
+    /// Keeps a connection which is done with its response.
+    pub fn checkin(&mut self, backend: usize, stream: TcpStream) {
+        let idle = &mut self.idle[backend];
+        if idle.len() == MAX_IDLE {
+            idle.remove(0);
+        }
+        idle.push((stream, Instant::now()));
+    }
+
+    /// Closes the connections idle for too long.
+    pub fn expire(&mut self) {
+        for idle in &mut self.idle {
+            idle.retain(|(_, since)| since.elapsed() < IDLE_TIMEOUT);
+        }
+    }
+}
+
+/// True if the backend neither closed the connection nor sent anything
+/// since the last response, anything else makes it unusable.
+fn is_idle(stream: &TcpStream) -> bool {
+    let mut byte = [0];
+    matches!(stream.peek(&mut byte), Err(e) if e.kind() == ErrorKind::WouldBlock)
+}
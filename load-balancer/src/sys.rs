@@ -0,0 +1,243 @@
+//! The few Linux system calls std doesn't expose.
+
+use std::io;
+use std::net::{SocketAddr, TcpStream};
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+
+pub const EPOLLIN: u32 = 0x1;
+pub const EPOLLOUT: u32 = 0x4;
+pub const EPOLLRDHUP: u32 = 0x2000;
+pub const EPOLLEXCLUSIVE: u32 = 1 << 28;
+pub const EPOLLET: u32 = 1 << 31;
+
+const EPOLL_CLOEXEC: i32 = 0o2000000;
+const EPOLL_CTL_ADD: i32 = 1;
+const EPOLL_CTL_MOD: i32 = 3;
+
+const AF_INET: i32 = 2;
+const AF_INET6: i32 = 10;
+const SOCK_STREAM: i32 = 1;
+const SOCK_NONBLOCK: i32 = 0o4000;
+const SOCK_CLOEXEC: i32 = 0o2000000;
+const EINPROGRESS: i32 = 115;
+
+const O_NONBLOCK: i32 = 0o4000;
+const O_CLOEXEC: i32 = 0o2000000;
+const SPLICE_F_MOVE: u32 = 1;
+const SPLICE_F_NONBLOCK: u32 = 2;
+const F_SETPIPE_SZ: i32 = 1031;
+
+/// Capacity asked for pipes, the default one is only 64 KB.
+pub const PIPE_SIZE: usize = 256 * 1024;
+
+/// Matches the kernel layout, which is packed on x86_64 only.
+#[cfg_attr(target_arch = "x86_64", repr(C, packed))]
+#[cfg_attr(not(target_arch = "x86_64"), repr(C))]
+#[derive(Clone, Copy)]
+pub struct Event {
+    events: u32,
+    data: u64,
+}
+
+impl Event {
+    pub fn token(&self) -> u64 {
+        self.data
+    }
+}
+
+#[repr(C)]
+struct SockaddrIn {
+    family: u16,
+    port: [u8; 2],
+    addr: [u8; 4],
+    zero: [u8; 8],
+}
+
+#[repr(C)]
+struct SockaddrIn6 {
+    family: u16,
+    port: [u8; 2],
+    flowinfo: u32,
+    addr: [u8; 16],
+    scope_id: u32,
+}
+
+extern "C" {
+    fn epoll_create1(flags: i32) -> i32;
+    fn epoll_ctl(epfd: i32, op: i32, fd: i32, event: *mut Event) -> i32;
+    fn epoll_wait(epfd: i32, events: *mut Event, maxevents: i32, timeout: i32) -> i32;
+    fn close(fd: i32) -> i32;
+    fn socket(domain: i32, kind: i32, protocol: i32) -> i32;
+    fn connect(fd: i32, addr: *const u8, len: u32) -> i32;
+    fn pipe2(fds: *mut i32, flags: i32) -> i32;
+    fn fcntl(fd: i32, cmd: i32, arg: i32) -> i32;
+    fn splice(
+        fd_in: i32,
+        off_in: *mut i64,
+        fd_out: i32,
+        off_out: *mut i64,
+        len: usize,
+        flags: u32,
+    ) -> isize;
+}
+
+fn check(ret: i32) -> io::Result<i32> {
+    match ret {
+        -1 => Err(io::Error::last_os_error()),
+        _ => Ok(ret),
+    }
+}
+
+/// An epoll instance, closed on drop.
+pub struct Epoll {
+    fd: RawFd,
+}
+
+impl Epoll {
+    pub fn new() -> io::Result<Self> {
+        let fd = check(unsafe { epoll_create1(EPOLL_CLOEXEC) })?;
+        Ok(Epoll { fd })
+    }
+
+    /// Watches `fd` for `events`, which are reported with `token`.
+    ///
+    /// There is no way to stop watching: closing the socket does it.
+    pub fn add(&self, fd: RawFd, events: u32, token: u64) -> io::Result<()> {
+        let mut event = Event {
+            events,
+            data: token,
+        };
+        check(unsafe { epoll_ctl(self.fd, EPOLL_CTL_ADD, fd, &mut event) }).map(|_| ())
+    }
+
+    /// Changes the events and token of a watched `fd`.
+    pub fn modify(&self, fd: RawFd, events: u32, token: u64) -> io::Result<()> {
+        let mut event = Event {
+            events,
+            data: token,
+        };
+        check(unsafe { epoll_ctl(self.fd, EPOLL_CTL_MOD, fd, &mut event) }).map(|_| ())
+    }
+
+    /// Waits for events, at most `timeout` milliseconds if not negative,
+    /// replacing the content of `events` by what was received.
+    pub fn wait(&self, events: &mut Vec<Event>, timeout: i32) -> io::Result<()> {
+        events.clear();
+        let n = unsafe {
+            epoll_wait(
+                self.fd,
+                events.as_mut_ptr(),
+                events.capacity() as i32,
+                timeout,
+            )
+        };
+        match check(n) {
+            Ok(n) => {
+                // SAFETY: the kernel wrote the first `n` events
+                unsafe { events.set_len(n as usize) };
+                Ok(())
+            }
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => Ok(()),
+            Err(e) => Err(e),
+        }
+    }
+}
+
+impl Drop for Epoll {
+    fn drop(&mut self) {
+        unsafe { close(self.fd) };
+    }
+}
+
+/// Starts connecting to `addr` without waiting for the handshake.
+///
+/// The socket becomes writable once connected. A failure is only reported
+/// by the first read or write.
+pub fn connect_nonblocking(addr: &SocketAddr) -> io::Result<TcpStream> {
+    let domain = match addr {
+        SocketAddr::V4(_) => AF_INET,
+        SocketAddr::V6(_) => AF_INET6,
+    };
+    let fd = check(unsafe { socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) })?;
+    // SAFETY: a new socket, owned by the stream from now on
+    let stream = unsafe { TcpStream::from_raw_fd(fd) };
+
+    let ret = match addr {
+        SocketAddr::V4(a) => {
+            let sockaddr = SockaddrIn {
+                family: AF_INET as u16,
+                port: a.port().to_be_bytes(),
+                addr: a.ip().octets(),
+                zero: [0; 8],
+            };
+            let len = std::mem::size_of_val(&sockaddr) as u32;
+            unsafe { connect(fd, &sockaddr as *const _ as *const u8, len) }
+        }
+        SocketAddr::V6(a) => {
+            let sockaddr = SockaddrIn6 {
+                family: AF_INET6 as u16,
+                port: a.port().to_be_bytes(),
+                flowinfo: a.flowinfo(),
+                addr: a.ip().octets(),
+                scope_id: a.scope_id(),
+            };
+            let len = std::mem::size_of_val(&sockaddr) as u32;
+            unsafe { connect(fd, &sockaddr as *const _ as *const u8, len) }
+        }
+    };
+    match check(ret) {
+        Err(e) if e.raw_os_error() != Some(EINPROGRESS) => Err(e),
+        _ => Ok(stream),
+    }
+}
+
+/// A non-blocking pipe, through which `splice` moves data between sockets
+/// without copying it to user space.
+pub struct Pipe {
+    read: OwnedFd,
+    write: OwnedFd,
+}
+
+impl Pipe {
+    pub fn new() -> io::Result<Self> {
+        let mut fds = [0; 2];
+        check(unsafe { pipe2(fds.as_mut_ptr(), O_NONBLOCK | O_CLOEXEC) })?;
+        // Only a hint, it is capped by /proc/sys/fs/pipe-max-size
+        unsafe { fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE as i32) };
+        // SAFETY: two new descriptors, owned from now on
+        unsafe {
+            Ok(Pipe {
+                read: OwnedFd::from_raw_fd(fds[0]),
+                write: OwnedFd::from_raw_fd(fds[1]),
+            })
+        }
+    }
+
+    /// Moves at most `len` bytes from the socket `from` into the pipe.
+    pub fn fill_from(&self, from: &impl AsRawFd, len: usize) -> io::Result<usize> {
+        move_data(from.as_raw_fd(), self.write.as_raw_fd(), len)
+    }
+
+    /// Moves at most `len` bytes from the pipe to the socket `to`.
+    pub fn drain_to(&self, to: &impl AsRawFd, len: usize) -> io::Result<usize> {
+        move_data(self.read.as_raw_fd(), to.as_raw_fd(), len)
+    }
+}
+
+fn move_data(from: RawFd, to: RawFd, len: usize) -> io::Result<usize> {
+    let flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    let n = unsafe {
+        splice(
+            from,
+            std::ptr::null_mut(),
+            to,
+            std::ptr::null_mut(),
+            len,
+            flags,
+        )
+    };
+    match n {
+        -1 => Err(io::Error::last_os_error()),
+        n => Ok(n as usize),
+    }
+}